@@ -41,6 +41,7 @@
 #include <ctime>
 #include <map>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -265,6 +266,10 @@
 /** @brief Not used */
 #define UPNP_E_CANCELED            -210
 
+/** @brief Returned by a @ref VDCallback_ReadAsync callback when no data is
+ * available yet. The application must later call @ref UpnpVirtualDirReadReady. */
+#define UPNP_E_WOULD_BLOCK         -211
+
 /** @brief Not used */
 #define UPNP_E_EVENT_PROTOCOL        -300
 
@@ -387,13 +392,16 @@ typedef enum Upnp_EventType_e {
      * with the information about the event.  */
     UPNP_EVENT_RECEIVED,
 
-    /** Not used. */
+    /** The completion of a @ref UpnpRenewSubscriptionAsync call. The
+     * \b Event parameter is an @ref Upnp_Event_Subscribe structure. */
     UPNP_EVENT_RENEWAL_COMPLETE,
 
-    /** Not used. */
+    /** The completion of a @ref UpnpSubscribeAsync call. The \b Event
+     * parameter is an @ref Upnp_Event_Subscribe structure. */
     UPNP_EVENT_SUBSCRIBE_COMPLETE,
 
-    /** Not used. */
+    /** The completion of a @ref UpnpUnSubscribeAsync call. The \b Event
+     * parameter is an @ref Upnp_Event_Subscribe structure. */
     UPNP_EVENT_UNSUBSCRIBE_COMPLETE,
 
     /** The auto-renewal of a client subscription failed.   
@@ -406,7 +414,17 @@ typedef enum Upnp_EventType_e {
      * if auto-renewal of subscriptions is disabled.
      * The \b Event parameter is an @ref Upnp_Event_Subscribe
      * structure. The subscription is no longer valid. */
-    UPNP_EVENT_SUBSCRIPTION_EXPIRED
+    UPNP_EVENT_SUBSCRIPTION_EXPIRED,
+
+    /** Received by a control point when a UDA 2.0 multicast event
+     * arrives, if enabled by @ref UpnpReceiveMulticastEvents. The \b
+     * Event parameter contains an @ref Upnp_Multicast_Event structure. */
+    UPNP_EVENT_MULTICAST_RECEIVED,
+
+    /** Received by a control point instead of @ref UPNP_EVENT_RECEIVED
+     * when enabled by @ref UpnpReceiveEventViews. The \b Event
+     * parameter contains an @ref Upnp_Event_View structure. */
+    UPNP_EVENT_RECEIVED_VIEW
 } Upnp_EventType;
 
 
@@ -458,6 +476,18 @@ typedef enum {
     UPNP_OPTION_NEXTBOOTID,
     /** @brief SEARCHPORT value to be sent in SSDP messages, int arg follows. Currently ignored */
     UPNP_OPTION_SEARCHPORT,
+    /** @brief Number of threads for the HTTP server, int arg follows. The default (0) is to
+     *  use one thread per connection. With a fixed thread count, requests are handled by an
+     *  internal pool, and virtual directory transfers can use @ref VDCallback_ReadAsync
+     *  to avoid holding a thread while waiting for data. Note that SOAP and GENA request
+     *  processing also runs on the pool, so it should not be too small. */
+    UPNP_OPTION_WEBSERVER_THREADS,
+    /** @brief File where the device subscriptions are saved, const char* arg follows.
+     *  When set, the subscriptions of a root device are written to the file when the device
+     *  is unregistered (including by UpnpFinish()), and restored when a device with the same
+     *  UDN is registered again with the same CONFIGID, so that the control points keep
+     *  receiving events across a restart of the process. */
+    UPNP_OPTION_SUBSCRIPTIONS_FILE,
 } Upnp_InitOption;
 
 /** Used in the device callback API as parameter for
@@ -543,6 +573,46 @@ typedef struct Upnp_Event UpnpEvent;
 #define UpnpEvent_get_EventKey(x) ((x)->EventKey)
 #define UpnpEvent_get_ChangedVariables(x) ((x)->ChangedVariables)
 
+/** @ref UPNP_EVENT_RECEIVED_VIEW callback data. This is the same
+ * information as @ref Upnp_Event, but the strings are not copied: they
+ * point into the received request, and are only valid during the
+ * callback. */
+struct Upnp_Event_View {
+    /** @brief The subscription ID for this subscription. */
+    std::string_view Sid;
+
+    /** @brief The event sequence number. */
+    int EventKey{0};
+
+    /** @brief The changed variables, as name/value pairs in document
+     * order. The values are unescaped. */
+    std::vector<std::pair<std::string_view, std::string_view>> ChangedVariables;
+};
+
+/** @ref UPNP_EVENT_MULTICAST_RECEIVED callback data. */
+struct Upnp_Multicast_Event {
+    /** @brief The unique service name: device UDN and service type. */
+    std::string USN;
+
+    /** @brief The service identifier. */
+    std::string ServiceId;
+
+    /** @brief The multicast event sequence number for the service. */
+    int EventKey{0};
+
+    /** @brief The event level, e.g. upnp:/general or upnp:/info. */
+    std::string Level;
+
+    /** @brief The device BOOTID.UPNP.ORG value. */
+    int BootId{0};
+
+    /** @brief The changed multicast variables. */
+    std::unordered_map<std::string, std::string> ChangedVariables;
+
+    /** @brief The address of the device sending the event. */
+    struct sockaddr_storage DestAddr;
+};
+
 /** @ref UPNP_DISCOVERY_RESULT callback data. */
 struct Upnp_Discovery {
     /** @brief The result code of the @ref UpnpSearchAsync call. */
@@ -676,6 +746,17 @@ struct File_Info {
      * should not be standard HTTP headers (e.g. content-length/type)
      * but only specific ones like the DLNA ones. */
     std::vector<std::pair<std::string, std::string>> response_headers;
+
+    /** @brief Set by the client inside the @ref VDCallback_GetInfo function
+     * to let the library reuse the returned information for this many
+     * seconds, for further requests with the same path and virtual
+     * directory cookie (e.g. the multiple range requests issued by players
+     * for a track). The function is not called for these requests. Only
+     * set this if the result does not depend on the other request data
+     * (headers, client address). The request cookie is not cached: it
+     * will be null for requests answered from the cache. The default (0)
+     * disables caching. See also @ref UpnpVirtualDirClearInfoCache. */
+    int cache_ttl{0};
 };
 
 /* Compat code for libupnp-1.8 */
@@ -1615,6 +1696,139 @@ EXPORT_SPEC int UpnpNotifyXML(
     /** [in] Property set (changed variables) as XML string */
     const std::string& propset);
 
+/** @brief One event for UpnpNotifyBatch() */
+struct UpnpNotifyBatchEntry {
+    /** The device ID of the subdevice of the service generating the event. */
+    std::string UDN;
+    /** The unique identifier of the service generating the event. */
+    std::string serviceId;
+    /** Property set (changed variables) as XML string */
+    std::string propertySet;
+};
+
+/**
+ * @brief Sends events for several services of a device at once.
+ *
+ * This is equivalent to calling UpnpNotifyXML() for each entry, but more
+ * efficient when a state change affects several services: the services
+ * are all looked up first, and the notifications are handed to the
+ * sending thread together. Nothing is sent if one of the services is
+ * not found.
+ *
+ * @return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device
+ *             handle.
+ *     \li \c UPNP_E_INVALID_SERVICE: The UDN/serviceId pair in an entry
+ *             refers to an invalid service.
+ */
+EXPORT_SPEC int UpnpNotifyBatch(
+    /** [in] The handle to the device sending the events. */
+    UpnpDevice_Handle Hnd,
+    /** [in] The events. */
+    const std::vector<UpnpNotifyBatchEntry>& entries);
+
+/**
+ * @brief Sets state variable values in the library-managed state for a
+ * service, and sends an event with the changed variables.
+ *
+ * This is an alternative to UpnpNotify() and UpnpAcceptSubscription(),
+ * with the library keeping the current values:
+ * - Only the variables which actually changed are evented. Events for
+ *   variables with moderation parameters (see
+ *   UpnpSetStateVariableModeration()) are held back or skipped according
+ *   to the UPnP rules.
+ * - Once a value has been set for a service, the library accepts the new
+ *   subscriptions itself, sending the current values in the initial
+ *   event. The application does not receive the
+ *   UPNP_EVENT_SUBSCRIPTION_REQUEST callbacks for the service any more.
+ *
+ * The values must be ready for inclusion in the XML property set, as
+ * for UpnpNotify().
+ *
+ * @return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device
+ *             handle.
+ *     \li \c UPNP_E_INVALID_SERVICE: The \b DevId/\b ServId
+ *             pair refers to an invalid service.
+ *     \li \c UPNP_E_INVALID_PARAM: Invalid parameter.
+ */
+EXPORT_SPEC int UpnpSetStateVariables(
+    /** [in] The handle to the device. */
+    UpnpDevice_Handle Hnd,
+    /** [in] The device ID of the subdevice of the service. */
+    const char *DevID,
+    /** [in] The unique identifier of the service. */
+    const char *ServName,
+    /** [in] Pointer to an array of variable names. */
+    const char **VarName,
+    /** [in] Pointer to an array of new values for those variables. */
+    const char **NewVal,
+    /** [in] The count of variables. */
+    int cVariables);
+
+/**
+ * @brief Sets the event moderation for a variable in the library-managed
+ * service state (see UpnpSetStateVariables()).
+ *
+ * @return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device
+ *             handle.
+ *     \li \c UPNP_E_INVALID_SERVICE: The \b DevId/\b ServId
+ *             pair refers to an invalid service.
+ *     \li \c UPNP_E_INVALID_PARAM: Invalid parameter.
+ */
+EXPORT_SPEC int UpnpSetStateVariableModeration(
+    /** [in] The handle to the device. */
+    UpnpDevice_Handle Hnd,
+    /** [in] The device ID of the subdevice of the service. */
+    const char *DevID,
+    /** [in] The unique identifier of the service. */
+    const char *ServName,
+    /** [in] The variable name. */
+    const char *VarName,
+    /** [in] maxRate: minimum interval between two events for the
+     * variable, in milliseconds. A change occurring earlier is sent
+     * when the interval has elapsed, with the latest value. 0 for no
+     * limit. */
+    int maxRateMs,
+    /** [in] minDelta: for a numeric variable, changes smaller than this
+     * from the last evented value are not sent. 0 for no limit. */
+    double minDelta);
+
+/**
+ * @brief Sets the state variables of a service which are multicast
+ * (UDA 2.0 multicast eventing).
+ *
+ * These are the variables with the \c sendEvents="yes" and
+ * \c multicast="yes" attributes in the service description, which can be
+ * extracted with UPnPSCPDMulticastVariables(). When an event for the
+ * service includes some of them, they are also sent in a single multicast
+ * datagram, in addition to the normal NOTIFY to each subscriber.
+ *
+ * @return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device
+ *             handle.
+ *     \li \c UPNP_E_INVALID_SERVICE: The \b DevId/\b ServId
+ *             pair refers to an invalid service.
+ *     \li \c UPNP_E_INVALID_PARAM: Invalid parameter.
+ */
+EXPORT_SPEC int UpnpSetMulticastEventing(
+    /** [in] The handle to the device. */
+    UpnpDevice_Handle Hnd,
+    /** [in] The device ID of the subdevice of the service. */
+    const char *DevID,
+    /** [in] The unique identifier of the service. */
+    const char *ServName,
+    /** [in] The multicast variable names. Empty to disable. */
+    const std::vector<std::string>& VarNames,
+    /** [in] The event level sent in the LVL header, e.g. "upnp:/info".
+     * If NULL, "upnp:/general" is used. */
+    const char *Level);
+
 /**
  * @brief Sets the maximum number of subscriptions accepted per service.
  *
@@ -1635,6 +1849,90 @@ EXPORT_SPEC int UpnpSetMaxSubscriptions(
     /** The maximum number of subscriptions to be allowed per service. */
     int MaxSubscriptions);
 
+/** @brief Event delivery state for a device subscription. See UpnpGetSubscriptionsHealth(). */
+struct UpnpSubscriptionHealth {
+    /** Subscription ID */
+    Upnp_SID sid;
+    /** Device UDN */
+    std::string UDN;
+    /** Service ID */
+    std::string serviceId;
+    /** Count of events successfully delivered */
+    uint64_t delivered{0};
+    /** Count of failed deliveries */
+    uint64_t failed{0};
+    /** Number of failed deliveries since the last success */
+    int consecutiveFailures{0};
+    /** Time of the last successful delivery (time(2) value), 0 if none */
+    time_t lastSuccess{0};
+    /** Duration of the last successful delivery in milliseconds, -1 if none */
+    int lastLatencyMs{-1};
+    /** If not 0, the delivery is suspended after repeated failures, and
+     * will be retried at this time (time(2) value) with the merged pending
+     * events. */
+    time_t suspendedUntil{0};
+    /** Number of events waiting to be sent */
+    int queued{0};
+};
+
+/**
+ * @brief Retrieves the event delivery state for the subscriptions to a
+ * device's services.
+ *
+ * Events are not sent to a subscriber for a while after repeated delivery
+ * failures, so that unreachable Control Points do not slow down the event
+ * sending. The application can use this to monitor the subscribers.
+ *
+ * @return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device
+ *             handle.
+ */
+EXPORT_SPEC int UpnpGetSubscriptionsHealth(
+    /** [in] The handle of the device. */
+    UpnpDevice_Handle Hnd,
+    /** [out] The subscriptions state is appended to this. */
+    std::vector<UpnpSubscriptionHealth>& health);
+
+/** @brief Subscription counts and expiry statistics for a device. See
+ * UpnpGetSubscriptionStats(). */
+struct UpnpSubscriptionStats {
+    /** Current number of subscriptions, for all the device services */
+    int subscriptions{0};
+    /** Subscriptions with a finite timeout, in the expiry index */
+    int timed{0};
+    /** Earliest expiration time (time(2) value), 0 if none */
+    time_t nextExpiry{0};
+    /** Count of expired subscriptions removed by the expiry timer */
+    uint64_t expiredByTimer{0};
+    /** Count of expired subscriptions found when accessed, before the
+     * timer ran */
+    uint64_t expiredOnAccess{0};
+    /** Time the expiry timer is set for (time(2) value), 0 if none. The
+     * timer is shared by all the device handles. */
+    time_t expiryTimerTime{0};
+    /** Count of expiry timer runs, for all the device handles */
+    uint64_t expiryTimerRuns{0};
+};
+
+/**
+ * @brief Retrieves the subscription counts and expiry statistics for a
+ * device's services.
+ *
+ * Subscriptions which were not renewed are removed by a timer when they
+ * expire, and stop counting against the UpnpSetMaxSubscriptions() limit.
+ *
+ * @return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device
+ *             handle.
+ */
+EXPORT_SPEC int UpnpGetSubscriptionStats(
+    /** [in] The handle of the device. */
+    UpnpDevice_Handle Hnd,
+    /** [out] The statistics. */
+    UpnpSubscriptionStats& stats);
+
 /** @} Device interface: Eventing */
 
 /** \name  Client interface: Eventing 
@@ -1756,6 +2054,88 @@ EXPORT_SPEC int UpnpUnSubscribe(
     /** [in] The ID returned when the control point subscribed to the service. */
     const Upnp_SID& SubsId);
 
+/**
+ * @brief Subscribes to a service, without waiting for the result.
+ *
+ * The request is performed by an internal thread, which handles many
+ * requests in parallel, up to a compile-time limit. When it completes,
+ * the callback is called with @ref UPNP_EVENT_SUBSCRIBE_COMPLETE and an
+ * @ref Upnp_Event_Subscribe structure, holding the status, the SID and
+ * the granted time-out. The subscription is then managed as one
+ * created by @ref UpnpSubscribe.
+ *
+ * @return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The request was queued.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid control
+ *             point handle.
+ *     \li \c UPNP_E_INVALID_PARAM: \b EvtUrl is not valid.
+ *     \li \c UPNP_E_SOCKET_CONNECT: No local interface to reach the URL.
+ *     \li \c UPNP_E_FINISH: The library is not initialized.
+ */
+EXPORT_SPEC int UpnpSubscribeAsync(
+    /** [in] The handle of the control point. */
+    UpnpClient_Handle Hnd,
+    /** [in] The URL of the service to subscribe to. */
+    const char *EvtUrl,
+    /** [in] The requested subscription time, -1 for infinite. */
+    int TimeOut,
+    /** [in] The completion callback. If null, the control point
+     * callback and cookie are used. */
+    Upnp_FunPtr Fun,
+    /** [in] Cookie passed to the callback. */
+    const void *Cookie);
+
+/**
+ * @brief Renews a subscription, without waiting for the result.
+ *
+ * The callback is called with @ref UPNP_EVENT_RENEWAL_COMPLETE when the
+ * request completes. As for @ref UpnpRenewSubscription, the
+ * subscription is removed if the renewal fails.
+ *
+ * @return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The request was queued.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid control
+ *             point handle.
+ *     \li \c UPNP_E_INVALID_SID: The SID is not a valid subscription ID.
+ *     \li \c UPNP_E_FINISH: The library is not initialized.
+ */
+EXPORT_SPEC int UpnpRenewSubscriptionAsync(
+    /** [in] The handle of the control point. */
+    UpnpClient_Handle Hnd,
+    /** [in] The requested subscription time, -1 for infinite. */
+    int TimeOut,
+    /** [in] The ID for the subscription to renew. */
+    const Upnp_SID& SubsId,
+    /** [in] The completion callback. If null, the control point
+     * callback and cookie are used. */
+    Upnp_FunPtr Fun,
+    /** [in] Cookie passed to the callback. */
+    const void *Cookie);
+
+/**
+ * @brief Removes a subscription, without waiting for the result.
+ *
+ * The callback is called with @ref UPNP_EVENT_UNSUBSCRIBE_COMPLETE when
+ * the request completes. The subscription is removed in any case.
+ *
+ * @return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The request was queued.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid control
+ *             point handle.
+ *     \li \c UPNP_E_INVALID_SID: The SID is not a valid subscription ID.
+ *     \li \c UPNP_E_FINISH: The library is not initialized.
+ */
+EXPORT_SPEC int UpnpUnSubscribeAsync(
+    /** [in] The handle of the control point. */
+    UpnpClient_Handle Hnd,
+    /** [in] The ID returned when the control point subscribed to the service. */
+    const Upnp_SID& SubsId,
+    /** [in] The completion callback. If null, the control point
+     * callback and cookie are used. */
+    Upnp_FunPtr Fun,
+    /** [in] Cookie passed to the callback. */
+    const void *Cookie);
+
 /**
  * @brief Sets the maximum time-out accepted for a subscription request or renewal.
  *
@@ -1798,6 +2178,46 @@ EXPORT_SPEC int UpnpSubsOpsTimeoutMs(
     /** [in] Timeout value in milliseconds. */
     int TimeOutMS);
 
+/**
+ * @brief Enables or disables the reception of the UDA 2.0 multicast events.
+ *
+ * When enabled, the events multicast by the devices on the network are
+ * passed to the control point callback with the @ref
+ * UPNP_EVENT_MULTICAST_RECEIVED type. No subscription is needed: a device
+ * sends a single datagram for all the control points. Disabled by default.
+ *
+ * @return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid control
+ *             point handle.
+ */
+EXPORT_SPEC int UpnpReceiveMulticastEvents(
+    /** [in] The handle of the control point. */
+    UpnpClient_Handle Hnd,
+    /** [in] Enable or disable. */
+    bool enable);
+
+/**
+ * @brief Chooses the zero-copy delivery of the subscription events.
+ *
+ * When enabled, the events are passed to the control point callback
+ * with the @ref UPNP_EVENT_RECEIVED_VIEW type and an @ref
+ * Upnp_Event_View structure, instead of @ref UPNP_EVENT_RECEIVED. The
+ * variable names and values then point into the request buffer, which
+ * avoids copying them, but they must be copied by the callback if they
+ * are needed after it returns. Disabled by default.
+ *
+ * @return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid control
+ *             point handle.
+ */
+EXPORT_SPEC int UpnpReceiveEventViews(
+    /** [in] The handle of the control point. */
+    UpnpClient_Handle Hnd,
+    /** [in] Enable or disable. */
+    bool enable);
+
 /** @} Client interface: Eventing */
 
 /**
@@ -1959,6 +2379,72 @@ EXPORT_SPEC int UpnpSetWebServerCorsString(
     /*! [in] String having the Access-Control-Allow-Origin string. */
     const char *corsString);
 
+/**
+ * @brief Sets bandwidth limits for the web server file and virtual directory transfers.
+ *
+ * The limits are enforced with token buckets: a global one, and one per client address.
+ * Small transfers (e.g. description documents) are not limited, so that control
+ * traffic stays responsive while streams are running. SOAP and GENA traffic is not
+ * affected.
+ *
+ * @param globalRate maximum total rate in bytes per second. 0 for no limit.
+ * @param clientRate maximum rate for each client address in bytes per second. 0 for no limit.
+ * @return An integer representing one of the following:
+ *       \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *       \li \c UPNP_E_INVALID_PARAM: A rate value is negative.
+ */
+EXPORT_SPEC int UpnpSetWebServerRateLimits(int64_t globalRate, int64_t clientRate);
+
+/** @brief HTTP server access log entry. See UpnpSetAccessLog(). */
+struct UpnpAccessLogEntry {
+    /** Request method, e.g. "GET", "POST", "SUBSCRIBE" */
+    std::string method;
+    /** Request path, possibly truncated */
+    std::string path;
+    /** Client address */
+    std::string client;
+    /** HTTP status sent, or 0 if the request was refused without a response */
+    int status{0};
+    /** Response body size, or -1 if unknown (e.g. streamed virtual directory file) */
+    int64_t bytes{-1};
+    /** Request reception time */
+    time_t start{0};
+    /** Time from request reception to the response being ready to send, in microseconds */
+    uint32_t ttfb_us{0};
+    /** Time from request reception to request completion, in microseconds */
+    uint32_t duration_us{0};
+    /** False if the transfer was not completed normally (error, timeout, client close...) */
+    bool completed{false};
+};
+
+/**
+ * @brief Enables or disables the HTTP server access log.
+ *
+ * When enabled, an entry is recorded for every request processed by the
+ * HTTP server (description and files, SOAP, GENA). The entries are kept in
+ * a fixed-size lock-free ring buffer, and must be retrieved regularly by the
+ * application with UpnpDrainAccessLog(). When the buffer is full, new entries
+ * are dropped and counted. The overhead is low enough to leave the log on in
+ * production.
+ *
+ * @param capacity maximum number of entries kept between drains. Rounded up
+ *   to a power of 2. 0 disables the log.
+ * @return UPNP_E_SUCCESS or UPNP_E_INVALID_PARAM if the capacity is negative
+ *   or too big.
+ */
+EXPORT_SPEC int UpnpSetAccessLog(int capacity);
+
+/**
+ * @brief Retrieves and removes the accumulated access log entries.
+ *
+ * @param[out] entries the log entries are appended to this, oldest first.
+ * @param[out] dropped if not null, set to the number of entries dropped
+ *   because the buffer was full since the previous call.
+ * @return UPNP_E_SUCCESS, or UPNP_E_INVALID_PARAM if the log is not enabled.
+ */
+EXPORT_SPEC int UpnpDrainAccessLog(std::vector<UpnpAccessLogEntry>& entries,
+                                   uint64_t *dropped = nullptr);
+
 
 /** Handle returned by the @ref VDCallback_Open virtual directory function. */
 typedef void *UpnpWebFileHandle;
@@ -1986,6 +2472,30 @@ typedef int (*VDCallback_GetInfo)(
  */
 EXPORT_SPEC int UpnpVirtualDir_set_GetInfoCallback(VDCallback_GetInfo callback);
 
+/** @brief Variant of @ref VDCallback_GetInfo which receives the HTTP request headers as a
+ *  read-only reference to the library data instead of a copy. The \b request_headers and 
+ *  \b Os fields of the File_Info structure are not set (the user agent is available as 
+ *  the "user-agent" header). The reference is only valid during the call. */
+typedef int (*VDCallback_GetInfo2)(
+    /** [in] The name of the file to query. */
+    const char *filename,
+    /** [out] Pointer to a structure to store the information on the file. */
+    struct File_Info *info,
+    /** [in] The request headers. The names are lowercased. */
+    const std::map<std::string, std::string>& request_headers,
+    const void *cookie,
+    const void **request_cookiep
+    );
+
+/**
+ * @brief Sets the get_info2 callback function to be used to access a virtual
+ * directory. If this is set, it is used instead of the @ref VDCallback_GetInfo one.
+ * Set it to \c NULL to go back to using the latter.
+ * 
+ * @return \c UPNP_E_SUCCESS.
+ */
+EXPORT_SPEC int UpnpVirtualDir_set_GetInfo2Callback(VDCallback_GetInfo2 callback);
+
 /** @brief Virtual Directory Open callback function prototype. */
 typedef UpnpWebFileHandle (*VDCallback_Open)(
     /** [in] The name of the file to open. */ 
@@ -2029,6 +2539,57 @@ typedef int (*VDCallback_Read)(
  */
 EXPORT_SPEC int UpnpVirtualDir_set_ReadCallback(VDCallback_Read callback);
 
+/** Token identifying a virtual directory transfer for asynchronous reads. */
+typedef uint64_t UpnpWebReadToken;
+
+/**
+ * @brief Virtual Directory asynchronous Read callback function prototype.
+ *
+ * This is used instead of @ref VDCallback_Read if set. The callback
+ * should not block waiting for data. If no data is available, it
+ * should return @ref UPNP_E_WOULD_BLOCK, and later call @ref
+ * UpnpVirtualDirReadReady with the  token value when data (or EOF or an
+ * error) is available. The web server will then call the function again.
+ * Other return values are as for @ref VDCallback_Read.
+ *
+ * When the web server runs with a fixed number of threads (see @ref
+ * UPNP_OPTION_WEBSERVER_THREADS), the connection is suspended while waiting,
+ * and does not use a thread. Else the connection thread waits for the
+ * readiness signal.
+ */
+typedef int (*VDCallback_ReadAsync)(
+    /** [in] The handle of the file to read. */
+    UpnpWebFileHandle fileHnd,
+    /** [out] The buffer in which to place the data. */
+    char *buf,
+    /** [in] The size of the buffer (i.e. the number of bytes to read). */
+    size_t buflen,
+    const void *cookie,
+    const void *request_cookie,
+    /** [in] Value to use with @ref UpnpVirtualDirReadReady. This is valid until the
+     *  close callback is called for the file. */
+    UpnpWebReadToken token
+    );
+
+/**
+ * @brief Sets the asynchronous read callback function to be used to access a virtual
+ * directory. Set it to \c NULL to go back to using the @ref VDCallback_Read callback.
+ *
+ *  @return \c UPNP_E_SUCCESS.
+ */
+EXPORT_SPEC int UpnpVirtualDir_set_ReadAsyncCallback(VDCallback_ReadAsync callback);
+
+/**
+ * @brief Signal that data is available for a transfer for which the @ref
+ * VDCallback_ReadAsync callback returned @ref UPNP_E_WOULD_BLOCK. This can be
+ * called from any thread.
+ *
+ *  @return An integer representing one of the following:
+ *       \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *       \li \c UPNP_E_INVALID_PARAM: \b token does not designate an active transfer.
+ */
+EXPORT_SPEC int UpnpVirtualDirReadReady(UpnpWebReadToken token);
+
 /** @brief Virtual Directory Write callback function prototype. */
 typedef    int (*VDCallback_Write)(
     /** [in] The handle of the file to write. */
@@ -2167,6 +2728,15 @@ EXPORT_SPEC int UpnpRemoveVirtualDir(
  */
 EXPORT_SPEC void UpnpRemoveAllVirtualDirs(void);
 
+/**
+ * @brief Discards cached @ref VDCallback_GetInfo results (see File_Info::cache_ttl).
+ *
+ * @param path if not null, only discard the entries for this path (as
+ *   passed to @ref VDCallback_GetInfo), else discard all entries.
+ * @return \c UPNP_E_SUCCESS.
+ */
+EXPORT_SPEC int UpnpVirtualDirClearInfoCache(const char *path);
+
 /* @} Web Server API */
 
 #endif /* UPNP_H */
@@ -89,4 +89,14 @@ public:
     std::vector<UPnPDeviceDesc> embedded;
 };
 
+/**
+ * Extract the names of the multicast state variables (with the
+ * sendEvents="yes" and multicast="yes" attributes, UDA 2.0) from a
+ * service description document.
+ *
+ * @return false if the document could not be parsed.
+ */
+EXPORT_SPEC bool UPnPSCPDMulticastVariables(
+    const std::string& scpd, std::vector<std::string>& names);
+
 #endif /* _UPNPDEV_HXX_INCLUDED_ */
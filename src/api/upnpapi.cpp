@@ -38,6 +38,7 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -80,10 +81,10 @@
 /*! This structure is for virtual directory callbacks */
 struct VirtualDirCallbacks virtualDirCallback;
 
-// Mutex to synchronize handles (root device or control point
-// handle). This used to be an rwlock but this was probably not worth
-// the trouble given the small expected contention level
-std::mutex globalHndLock;
+// Lock for the handle table and the handle data (root device or
+// control point handle). The SSDP, SOAP and handle checking paths
+// only read and take it shared, see HANDLELOCK_SHARED().
+std::shared_mutex globalHndLock;
 
 /*! Initialization mutex. */
 static std::mutex gSDKInitMutex;
@@ -120,9 +121,13 @@ unsigned int g_optionFlags;
 /* SSDP bootid and configid. These default to 1, but should be managed by our user */
 int g_bootidUpnpOrg{1};
 int g_configidUpnpOrg{1};
+/* File for persisting the device subscriptions across restarts */
+std::string g_subscriptionsFile;
 
 /* Local global options, usually set from the options list of initWithOptions */
 static int o_networkWaitSeconds = 60;
+/* HTTP server thread count. 0 means thread per connection */
+int g_webServerThreads{0};
 
 /* Marker to be replaced by an appropriate address in LOCATION URLs */
 const std::string g_HostForTemplate{"@HOST_ADDR_FOR@"};
@@ -136,22 +141,29 @@ unsigned short LOCAL_PORT_V6;
 #define NUM_HANDLE 200
 static std::array<struct Handle_Info*, NUM_HANDLE> HandleTable;
 
+#ifdef INCLUDE_DEVICE_APIS
+/*! Device handle for each service control or event URL path (as computed by
+ * servicePathKey()), for routing the SOAP and GENA requests. Protected by
+ * the handle lock. */
+static std::unordered_map<std::string, UpnpDevice_Handle> ServicePathHandles;
+#endif
+
 /*! Maximum content-length (in bytes) that the SDK will process on an incoming
  * packet. Content-Length exceeding this size will be not processed and
  * error 413 (HTTP Error Code) will be returned to the remote end point. */
 size_t g_maxContentLength = DEFAULT_SOAP_CONTENT_LENGTH;
 
-/*! Global variable to determines the maximum number of
+/*! Global variable to determines the maximum size of the
  *    events which can be queued for a given subscription before events begin
  *    to be discarded. This limits the amount of memory used for a
  *    non-responding subscribed entity. */
-int g_UpnpSdkEQMaxLen = MAX_SUBSCRIPTION_QUEUED_EVENTS;
+size_t g_UpnpSdkEQMaxBytes = MAX_SUBSCRIPTION_QUEUED_BYTES;
 
 /*! Global variable to determine the maximum number of
  *    seconds which an event can spend on a subscription queue (waiting for the
  *    event at the head of the queue to be communicated). This parameter will
  *    have no effect in most situations with the default (low) value of
- *    MAX_SUBSCRIPTION_QUEUED_EVENTS. However, if MAX_SUBSCRIPTION_QUEUED_EVENTS
+ *    MAX_SUBSCRIPTION_QUEUED_BYTES. However, if MAX_SUBSCRIPTION_QUEUED_BYTES
  *    is set to a high value, the AGE parameter will allow pruning the queue in
  *    good conformance with the UPnP Device Architecture standard, at the
  *    price of higher potential memory use. */
@@ -482,6 +494,9 @@ static int UpnpInitPreamble()
     {
         HANDLELOCK();
         HandleTable = {};
+#ifdef INCLUDE_DEVICE_APIS
+        ServicePathHandles.clear();
+#endif
     }
 
     /* Initialize SDK global thread pools. */
@@ -511,6 +526,23 @@ static int UpnpInitPreamble()
         return UPNP_E_INIT_FAILED;
     }
 
+#if EXCLUDE_GENA == 0 && defined(INCLUDE_DEVICE_APIS)
+    if (genaNotifyEngineStart() != UPNP_E_SUCCESS) {
+        UpnpPrintf(UPNP_CRITICAL, API, __FILE__, __LINE__,
+                   "GENA notification engine init failed\n");
+        UpnpFinish();
+        return UPNP_E_INIT_FAILED;
+    }
+#endif
+#if EXCLUDE_GENA == 0 && defined(INCLUDE_CLIENT_APIS)
+    if (genaSubsOpsEngineStart() != UPNP_E_SUCCESS) {
+        UpnpPrintf(UPNP_CRITICAL, API, __FILE__, __LINE__,
+                   "GENA subscription engine init failed\n");
+        UpnpFinish();
+        return UPNP_E_INIT_FAILED;
+    }
+#endif
+
     return UPNP_E_SUCCESS;
 }
 
@@ -685,6 +717,17 @@ EXPORT_SPEC int UpnpInitWithOptions(
             if (g_configidUpnpOrg <= 0)
                 g_configidUpnpOrg = 1;
             break;
+        case UPNP_OPTION_SUBSCRIPTIONS_FILE:
+        {
+            const char *fn = va_arg(ap, const char *);
+            g_subscriptionsFile = fn ? fn : "";
+        }
+        break;
+        case UPNP_OPTION_WEBSERVER_THREADS:
+            g_webServerThreads = va_arg(ap, int);
+            if (g_webServerThreads < 0)
+                g_webServerThreads = 0;
+            break;
         default:
             UpnpPrintf(UPNP_CRITICAL, API, __FILE__, __LINE__,
                        "UpnPInitWithOptions: bad option %d in list\n", option);
@@ -779,11 +822,25 @@ EXPORT_SPEC int UpnpFinish()
         break;
     }
 #endif
-    gTimerThread->shutdown();
-    delete gTimerThread;
+#if EXCLUDE_GENA == 0 && defined(INCLUDE_DEVICE_APIS)
+    genaNotifyEngineStop();
+#endif
+#if EXCLUDE_SSDP == 0 && defined(INCLUDE_DEVICE_APIS)
+    ssdpCloseMulticastEventSockets();
+#endif
+#if EXCLUDE_GENA == 0 && defined(INCLUDE_CLIENT_APIS)
+    genaSubsOpsEngineStop();
+#endif
+#if EXCLUDE_WEB_SERVER == 0
+    // Suspended connections must be resumed before the HTTP server can be
+    // stopped. This also stops the rate-limited transfers from setting timers.
+    web_server_abort_async_reads();
+#endif
 #if EXCLUDE_MINISERVER == 0
     StopMiniServer();
 #endif
+    gTimerThread->shutdown();
+    delete gTimerThread;
 #if EXCLUDE_WEB_SERVER == 0
     web_server_destroy();
 #endif
@@ -922,6 +979,42 @@ static int GetFreeHandle()
     return std::distance(HandleTable.begin(), it);
 }
 
+#ifdef INCLUDE_DEVICE_APIS
+/* Add the service paths for a device handle to the routing index. If a path
+   is already present, the previously registered device keeps it. */
+static void indexServicePaths(int hnd)
+{
+    const auto& table = HandleTable[hnd]->serviceTable;
+    for (const auto& ent : table.byControlPath) {
+        ServicePathHandles.emplace(ent.first, hnd);
+    }
+    for (const auto& ent : table.byEventPath) {
+        ServicePathHandles.emplace(ent.first, hnd);
+    }
+}
+
+static void unindexServicePaths(int hnd)
+{
+    bool found{false};
+    for (auto it = ServicePathHandles.begin(); it != ServicePathHandles.end();) {
+        if (it->second == hnd) {
+            it = ServicePathHandles.erase(it);
+            found = true;
+        } else {
+            it++;
+        }
+    }
+    // Another device may have been registered with a duplicate path
+    if (found) {
+        for (int idx = 1; idx < NUM_HANDLE; idx++) {
+            if (idx != hnd && HandleTable[idx] && HandleTable[idx]->HType == HND_DEVICE) {
+                indexServicePaths(idx);
+            }
+        }
+    }
+}
+#endif /* INCLUDE_DEVICE_APIS */
+
 /*!
  * \brief Free handle.
  *
@@ -931,6 +1024,11 @@ static int FreeHandle(int handleindex)
 {
     if (handleindex >= 1 && handleindex < NUM_HANDLE) {
         if (HandleTable[handleindex] != nullptr) {
+#ifdef INCLUDE_DEVICE_APIS
+            if (HandleTable[handleindex]->HType == HND_DEVICE) {
+                unindexServicePaths(handleindex);
+            }
+#endif
             delete HandleTable[handleindex];
             HandleTable[handleindex] = nullptr;
             return UPNP_E_SUCCESS;
@@ -1037,6 +1135,8 @@ static int registerRootDeviceAllForms(
      */
     hasServiceTable = initServiceTable(HInfo->devdesc, HInfo->serviceTable);
     if (hasServiceTable) {
+        indexServicePaths(*Hnd);
+        genaRestoreSubscriptions(HInfo);
         UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,"registerRootDeviceAllForms: GENA services:\n");
         printServiceTable(HInfo->serviceTable, UPNP_ALL, API);
     } else {
@@ -1186,7 +1286,7 @@ int UpnpUnRegisterClient(UpnpClient_Handle Hnd)
         return UPNP_E_FINISH;
 
     {
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         if (!UpnpSdkClientRegistered) {
             return UPNP_E_INVALID_HANDLE;
         }
@@ -1491,7 +1591,7 @@ static int searchAsyncUniMulti(
     }
 
     {
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         if (checkHandle(HND_CLIENT, hnd) == HND_INVALID) {
             return UPNP_E_INVALID_HANDLE;
         }
@@ -1588,6 +1688,36 @@ int UpnpSetMaxSubscriptionTimeOut(UpnpDevice_Handle Hnd, int MaxSubscriptionTime
 
     return UPNP_E_SUCCESS;
 }
+
+int UpnpGetSubscriptionsHealth(UpnpDevice_Handle Hnd, std::vector<UpnpSubscriptionHealth>& health)
+{
+    if (UpnpSdkInit != 1) {
+        return UPNP_E_FINISH;
+    }
+
+    struct Handle_Info *SInfo = nullptr;
+    HANDLELOCK_SHARED();
+    if (checkHandle(HND_DEVICE, Hnd, &SInfo) == HND_INVALID) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    for (const auto& service : SInfo->serviceTable) {
+        for (const auto& sub : service.subscriptionList) {
+            UpnpSubscriptionHealth h;
+            h.sid = sub.sid;
+            h.UDN = service.UDN;
+            h.serviceId = service.serviceId;
+            h.delivered = sub.delivered;
+            h.failed = sub.failed;
+            h.consecutiveFailures = sub.consecutiveFailures;
+            h.lastSuccess = sub.lastSuccess;
+            h.lastLatencyMs = sub.lastLatencyMs;
+            h.suspendedUntil = sub.suspendedUntil;
+            h.queued = static_cast<int>(sub.outgoing.size());
+            health.push_back(std::move(h));
+        }
+    }
+    return UPNP_E_SUCCESS;
+}
 #endif /* INCLUDE_DEVICE_APIS */
 
 #ifdef INCLUDE_CLIENT_APIS
@@ -1612,6 +1742,40 @@ int UpnpSubsOpsTimeoutMs(UpnpClient_Handle Hnd, int TimeOutMS)
     return UPNP_E_SUCCESS;
 }
 
+int UpnpReceiveMulticastEvents(UpnpClient_Handle Hnd, bool enable)
+{
+    struct Handle_Info *SInfo = nullptr;
+
+    if (UpnpSdkInit != 1) {
+        return UPNP_E_FINISH;
+    }
+
+    HANDLELOCK();
+    if (checkHandle(HND_CLIENT, Hnd, &SInfo) == HND_INVALID) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    SInfo->MulticastEvents = enable;
+
+    return UPNP_E_SUCCESS;
+}
+
+int UpnpReceiveEventViews(UpnpClient_Handle Hnd, bool enable)
+{
+    struct Handle_Info *SInfo = nullptr;
+
+    if (UpnpSdkInit != 1) {
+        return UPNP_E_FINISH;
+    }
+
+    HANDLELOCK();
+    if (checkHandle(HND_CLIENT, Hnd, &SInfo) == HND_INVALID) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    SInfo->EventViews = enable;
+
+    return UPNP_E_SUCCESS;
+}
+
 int UpnpSubscribe(UpnpClient_Handle Hnd, const char *EvtUrl, int *TimeOut, Upnp_SID& SubsId)
 {
     UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__, "UpnpSubscribe\n");
@@ -1625,7 +1789,7 @@ int UpnpSubscribe(UpnpClient_Handle Hnd, const char *EvtUrl, int *TimeOut, Upnp_
     }
 
     {
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         if (checkHandle(HND_CLIENT, Hnd) == HND_INVALID) {
             return UPNP_E_INVALID_HANDLE;
         }
@@ -1648,7 +1812,7 @@ int UpnpUnSubscribe(UpnpClient_Handle Hnd, const Upnp_SID& SubsId)
     }
 
     {
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         if (checkHandle(HND_CLIENT, Hnd) == HND_INVALID) {
             return UPNP_E_INVALID_HANDLE;
         }
@@ -1676,7 +1840,7 @@ int UpnpRenewSubscription(UpnpClient_Handle Hnd, int *TimeOut, const Upnp_SID& S
     }
 
     {
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         if (checkHandle(HND_CLIENT, Hnd) == HND_INVALID) {
             return UPNP_E_INVALID_HANDLE;
         }
@@ -1689,6 +1853,45 @@ int UpnpRenewSubscription(UpnpClient_Handle Hnd, int *TimeOut, const Upnp_SID& S
 }
 #endif /* INCLUDE_CLIENT_APIS */
 
+#ifdef INCLUDE_CLIENT_APIS
+int UpnpSubscribeAsync(UpnpClient_Handle Hnd, const char *EvtUrl, int TimeOut,
+                       Upnp_FunPtr Fun, const void *Cookie)
+{
+    if (UpnpSdkInit != 1) {
+        return UPNP_E_FINISH;
+    }
+    if (EvtUrl == nullptr) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    int retVal = genaSubscribeAsync(Hnd, EvtUrl, TimeOut, Fun, Cookie);
+    UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__, "UpnpSubscribeAsync: retVal=%d\n", retVal);
+    return retVal;
+}
+
+int UpnpRenewSubscriptionAsync(UpnpClient_Handle Hnd, int TimeOut, const Upnp_SID& SubsId,
+                               Upnp_FunPtr Fun, const void *Cookie)
+{
+    if (UpnpSdkInit != 1) {
+        return UPNP_E_FINISH;
+    }
+    int retVal = genaRenewSubscriptionAsync(Hnd, SubsId, TimeOut, Fun, Cookie);
+    UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
+               "UpnpRenewSubscriptionAsync: retVal=%d\n", retVal);
+    return retVal;
+}
+
+int UpnpUnSubscribeAsync(UpnpClient_Handle Hnd, const Upnp_SID& SubsId,
+                         Upnp_FunPtr Fun, const void *Cookie)
+{
+    if (UpnpSdkInit != 1) {
+        return UPNP_E_FINISH;
+    }
+    int retVal = genaUnSubscribeAsync(Hnd, SubsId, Fun, Cookie);
+    UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__, "UpnpUnSubscribeAsync: retVal=%d\n", retVal);
+    return retVal;
+}
+#endif /* INCLUDE_CLIENT_APIS */
+
 #ifdef INCLUDE_DEVICE_APIS
 int UpnpNotify(UpnpDevice_Handle Hnd, const char *DevID, const char *ServName,
                const char **VarName, const char **NewVal, int cVariables)
@@ -1704,7 +1907,7 @@ int UpnpNotify(UpnpDevice_Handle Hnd, const char *DevID, const char *ServName,
     UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__, "UpnpNotify\n");
 
     {
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         if (checkHandle(HND_DEVICE, Hnd) == HND_INVALID) {
             return UPNP_E_INVALID_HANDLE;
         }
@@ -1729,7 +1932,7 @@ int UpnpNotifyXML(UpnpDevice_Handle Hnd, const char *DevID,
     UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__, "UpnpNotifyXML\n");
 
     {
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         if (checkHandle(HND_DEVICE, Hnd) == HND_INVALID) {
             return UPNP_E_INVALID_HANDLE;
         }
@@ -1741,6 +1944,65 @@ int UpnpNotifyXML(UpnpDevice_Handle Hnd, const char *DevID,
     return retVal;
 }
 
+int UpnpNotifyBatch(UpnpDevice_Handle Hnd, const std::vector<UpnpNotifyBatchEntry>& entries)
+{
+    if (UpnpSdkInit != 1) {
+        return UPNP_E_FINISH;
+    }
+    UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__, "UpnpNotifyBatch: %d events\n",
+               int(entries.size()));
+    int retVal = genaNotifyBatch(Hnd, entries);
+    UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__, "UpnpNotifyBatch ret %d\n", retVal);
+    return retVal;
+}
+
+int UpnpGetSubscriptionStats(UpnpDevice_Handle Hnd, UpnpSubscriptionStats& stats)
+{
+    if (UpnpSdkInit != 1) {
+        return UPNP_E_FINISH;
+    }
+    return genaGetSubscriptionStats(Hnd, stats);
+}
+
+int UpnpSetStateVariables(UpnpDevice_Handle Hnd, const char *DevID, const char *ServName,
+                          const char **VarName, const char **NewVal, int cVariables)
+{
+    if (UpnpSdkInit != 1) {
+        return UPNP_E_FINISH;
+    }
+    if (DevID == nullptr || ServName == nullptr || VarName == nullptr || NewVal == nullptr
+        || cVariables < 0) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    return genaSetStateVariables(Hnd, DevID, ServName, VarName, NewVal, cVariables);
+}
+
+int UpnpSetStateVariableModeration(UpnpDevice_Handle Hnd, const char *DevID,
+                                   const char *ServName, const char *VarName,
+                                   int maxRateMs, double minDelta)
+{
+    if (UpnpSdkInit != 1) {
+        return UPNP_E_FINISH;
+    }
+    if (DevID == nullptr || ServName == nullptr || VarName == nullptr || maxRateMs < 0 ||
+        minDelta < 0) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    return genaSetStateVariableModeration(Hnd, DevID, ServName, VarName, maxRateMs, minDelta);
+}
+
+int UpnpSetMulticastEventing(UpnpDevice_Handle Hnd, const char *DevID, const char *ServName,
+                             const std::vector<std::string>& VarNames, const char *Level)
+{
+    if (UpnpSdkInit != 1) {
+        return UPNP_E_FINISH;
+    }
+    if (DevID == nullptr || ServName == nullptr) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    return genaSetMulticastEventing(Hnd, DevID, ServName, VarNames, Level);
+}
+
 int UpnpAcceptSubscription(
     UpnpDevice_Handle Hnd, const char *DevID, const char *ServName,
     const char **VarName, const char **NewVal, int cVariables,
@@ -1756,7 +2018,7 @@ int UpnpAcceptSubscription(
     }
 
     {
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         if (checkHandle(HND_DEVICE, Hnd) == HND_INVALID) {
             return UPNP_E_INVALID_HANDLE;
         }
@@ -1783,7 +2045,7 @@ int UpnpAcceptSubscriptionXML(UpnpDevice_Handle Hnd, const char *DevID, const ch
     }
 
     {
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         if (checkHandle(HND_DEVICE, Hnd) == HND_INVALID) {
             return UPNP_E_INVALID_HANDLE;
         }
@@ -1827,7 +2089,7 @@ int UpnpSendAction(
         return UPNP_E_INVALID_PARAM;
     }
     {
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         if (checkHandle(HND_CLIENT, Hnd) == HND_INVALID) {
             return UPNP_E_INVALID_HANDLE;
         }
@@ -1931,16 +2193,21 @@ Upnp_Handle_Type GetDeviceHandleInfoForPath(
     *serv_info = nullptr;
 
 #ifdef INCLUDE_DEVICE_APIS
-
-    for (int idx = 1; idx < NUM_HANDLE;    idx++) {
-        Handle_Info *hinf;
-        if (GetHandleInfo(idx, &hinf) == HND_DEVICE) {
-            if ((*serv_info = FindServiceControlURLPath(hinf->serviceTable, path)) ||
-                (*serv_info = FindServiceEventURLPath(hinf->serviceTable, path))) {
-                *HndInfo = hinf;
-                *devhdl = idx;
-                return HND_DEVICE;
-            }
+    std::string key;
+    if (!servicePathKey(path, key)) {
+        return HND_INVALID;
+    }
+    auto it = ServicePathHandles.find(key);
+    if (it == ServicePathHandles.end()) {
+        return HND_INVALID;
+    }
+    Handle_Info *hinf;
+    if (GetHandleInfo(it->second, &hinf) == HND_DEVICE) {
+        if ((*serv_info = FindServiceControlURLPath(hinf->serviceTable, path)) ||
+            (*serv_info = FindServiceEventURLPath(hinf->serviceTable, path))) {
+            *HndInfo = hinf;
+            *devhdl = it->second;
+            return HND_DEVICE;
         }
     }
 #endif /* INCLUDE_DEVICE_APIS */
@@ -1990,6 +2257,30 @@ int UpnpSetWebServerCorsString(const char *corsString)
 
     return web_server_set_cors(corsString);
 }
+
+int UpnpSetWebServerRateLimits(int64_t globalRate, int64_t clientRate)
+{
+    if (UpnpSdkInit == 0)
+        return UPNP_E_FINISH;
+    if (globalRate < 0 || clientRate < 0) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    web_server_set_rate_limits(globalRate, clientRate);
+    return UPNP_E_SUCCESS;
+}
+
+int UpnpSetAccessLog(int capacity)
+{
+    if (capacity < 0 || capacity > (1 << 20)) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    return SetMiniServerAccessLog(static_cast<size_t>(capacity));
+}
+
+int UpnpDrainAccessLog(std::vector<UpnpAccessLogEntry>& entries, uint64_t *dropped)
+{
+    return DrainMiniServerAccessLog(entries, dropped);
+}
 #endif /* INTERNAL_WEB_SERVER */
 
 
@@ -2017,6 +2308,12 @@ void UpnpRemoveAllVirtualDirs()
     web_server_clear_virtual_dirs();
 }
 
+int UpnpVirtualDirClearInfoCache(const char *path)
+{
+    web_server_clear_info_cache(path);
+    return UPNP_E_SUCCESS;
+}
+
 
 int UpnpEnableWebserver(int enable)
 {
@@ -2095,6 +2392,13 @@ int UpnpVirtualDir_set_GetInfoCallback(VDCallback_GetInfo callback)
 }
 
 
+int UpnpVirtualDir_set_GetInfo2Callback(VDCallback_GetInfo2 callback)
+{
+    virtualDirCallback.get_info2 = callback;
+    return UPNP_E_SUCCESS;
+}
+
+
 int UpnpVirtualDir_set_OpenCallback(VDCallback_Open callback)
 {
     int ret = UPNP_E_SUCCESS;
@@ -2120,6 +2424,17 @@ int UpnpVirtualDir_set_ReadCallback(VDCallback_Read callback)
     return ret;
 }
 
+int UpnpVirtualDir_set_ReadAsyncCallback(VDCallback_ReadAsync callback)
+{
+    virtualDirCallback.read_async = callback;
+    return UPNP_E_SUCCESS;
+}
+
+int UpnpVirtualDirReadReady(UpnpWebReadToken token)
+{
+    return web_server_read_ready(token);
+}
+
 
 int UpnpVirtualDir_set_WriteCallback(VDCallback_Write callback)
 {
@@ -2168,9 +2483,9 @@ int UpnpSetMaxContentLength(size_t contentLength)
     return UPNP_E_SUCCESS;
 }
 
-[[maybe_unused]] static int UpnpSetEventQueueLimits(int maxLen, int maxAge)
+[[maybe_unused]] static int UpnpSetEventQueueLimits(size_t maxBytes, int maxAge)
 {
-    g_UpnpSdkEQMaxLen = maxLen;
+    g_UpnpSdkEQMaxBytes = maxBytes;
     g_UpnpSdkEQMaxAge = maxAge;
     return UPNP_E_SUCCESS;
 }
@@ -54,16 +54,19 @@
 #include "upnpapi.h"
 #include "uri.h"
 
+#include <atomic>
 #include <cerrno>
 #include <chrono>
 #include <condition_variable>
 #include <cstdio>
 #include <cstring>
+#include <memory>
 
 #include <microhttpd.h>
 
 #if MHD_VERSION < 0x00095300
 #define MHD_USE_INTERNAL_POLLING_THREAD MHD_USE_SELECT_INTERNALLY
+#define MHD_ALLOW_SUSPEND_RESUME MHD_USE_SUSPEND_RESUME
 #endif
 
 #if MHD_VERSION <= 0x00097000
@@ -167,10 +170,202 @@ static const std::map<std::string_view, int> strmethtometh {
     {"unsubscribe", HTTPMETHOD_UNSUBSCRIBE},
 };
 
-static void request_completed_cb(void*, MHD_Connection*, MHDTransaction** con_cls, MHD_RequestTerminationCode)
+/* Access log. The MHD threads record one entry per request into a
+   bounded lock-free ring (multi-producer, after D. Vyukov's bounded
+   MPMC queue), which the application empties with
+   UpnpDrainAccessLog(). The producers only copy a fixed size record,
+   formatting is done when draining. When the ring is full, entries
+   are dropped and counted. */
+struct AccessLogRecord {
+    struct sockaddr_storage client;
+    http_method_t method;
+    int status;
+    int64_t bytes;
+    time_t start;
+    uint32_t ttfb_us;
+    uint32_t duration_us;
+    bool completed;
+    char path[200];
+};
+
+class AccessLogRing {
+public:
+    explicit AccessLogRing(size_t capacity)
+        : m_mask(capacity - 1), m_slots(new Slot[capacity]) {
+        for (size_t i = 0; i < capacity; i++) {
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    size_t capacity() const {
+        return m_mask + 1;
+    }
+    bool push(const AccessLogRecord& rec) {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = m_slots[pos & m_mask];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.rec = rec;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // Full
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    // Single consumer: the caller serializes the calls.
+    bool pop(AccessLogRecord& rec) {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        Slot& slot = m_slots[pos & m_mask];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != pos + 1) {
+            // Empty, or the producer has not finished writing the entry
+            return false;
+        }
+        rec = slot.rec;
+        slot.seq.store(pos + m_mask + 1, std::memory_order_release);
+        m_tail.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+    uint64_t takeDropped() {
+        return m_dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        AccessLogRecord rec;
+    };
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+    std::atomic<uint64_t> m_dropped{0};
+    size_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+};
+
+/* The current ring. Replaced rings are kept until the miniserver
+   stops, because an MHD thread may still be writing to them. */
+static std::atomic<AccessLogRing*> gAccessLog{nullptr};
+static std::vector<std::unique_ptr<AccessLogRing>> gAccessLogRetired;
+static std::unique_ptr<AccessLogRing> gAccessLogOwner;
+/* Serializes configuration changes and drains */
+static std::mutex gAccessLogMutex;
+
+int SetMiniServerAccessLog(size_t capacity)
+{
+    std::scoped_lock lck(gAccessLogMutex);
+    std::unique_ptr<AccessLogRing> ring;
+    if (capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        if (gAccessLogOwner && gAccessLogOwner->capacity() == size) {
+            return UPNP_E_SUCCESS;
+        }
+        ring = std::make_unique<AccessLogRing>(size);
+    }
+    gAccessLog.store(ring.get(), std::memory_order_release);
+    if (gAccessLogOwner) {
+        gAccessLogRetired.push_back(std::move(gAccessLogOwner));
+    }
+    gAccessLogOwner = std::move(ring);
+    return UPNP_E_SUCCESS;
+}
+
+static const char *methodName(http_method_t method)
+{
+    switch (method) {
+    case HTTPMETHOD_POST: case SOAPMETHOD_POST: return "POST";
+    case HTTPMETHOD_MPOST: return "M-POST";
+    case HTTPMETHOD_SUBSCRIBE: return "SUBSCRIBE";
+    case HTTPMETHOD_UNSUBSCRIBE: return "UNSUBSCRIBE";
+    case HTTPMETHOD_NOTIFY: return "NOTIFY";
+    case HTTPMETHOD_GET: case HTTPMETHOD_SIMPLEGET: return "GET";
+    case HTTPMETHOD_HEAD: return "HEAD";
+    case HTTPMETHOD_MSEARCH: return "M-SEARCH";
+    default: return "UNKNOWN";
+    }
+}
+
+int DrainMiniServerAccessLog(std::vector<UpnpAccessLogEntry>& entries, uint64_t *dropped)
+{
+    std::scoped_lock lck(gAccessLogMutex);
+    if (!gAccessLogOwner) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    // Entries left in retired rings are lost.
+    for (auto& ring : gAccessLogRetired) {
+        ring->takeDropped();
+    }
+    AccessLogRecord rec;
+    while (gAccessLogOwner->pop(rec)) {
+        UpnpAccessLogEntry entry;
+        entry.method = methodName(rec.method);
+        entry.path = rec.path;
+        entry.client =
+            NetIF::IPAddr(reinterpret_cast<struct sockaddr*>(&rec.client)).straddr();
+        entry.status = rec.status;
+        entry.bytes = rec.bytes;
+        entry.start = rec.start;
+        entry.ttfb_us = rec.ttfb_us;
+        entry.duration_us = rec.duration_us;
+        entry.completed = rec.completed;
+        entries.push_back(std::move(entry));
+    }
+    if (dropped) {
+        *dropped = gAccessLogOwner->takeDropped();
+    }
+    return UPNP_E_SUCCESS;
+}
+
+static uint32_t elapsedMicros(std::chrono::steady_clock::time_point from,
+                              std::chrono::steady_clock::time_point to)
 {
-    if (con_cls)
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+    return us < 0 ? 0 : static_cast<uint32_t>(std::min(us, static_cast<decltype(us)>(UINT32_MAX)));
+}
+
+static void accessLogRecord(const MHDTransaction *mhdt, MHD_RequestTerminationCode toe)
+{
+    auto ring = gAccessLog.load(std::memory_order_acquire);
+    if (nullptr == ring) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    AccessLogRecord rec;
+    rec.client = mhdt->client_address;
+    rec.method = mhdt->method;
+    rec.status = mhdt->httpstatus;
+    rec.bytes = mhdt->respsize;
+    rec.start = time(nullptr) - std::chrono::duration_cast<std::chrono::seconds>(
+        now - mhdt->starttime).count();
+    rec.ttfb_us = mhdt->queuedtime == std::chrono::steady_clock::time_point() ? 0 :
+        elapsedMicros(mhdt->starttime, mhdt->queuedtime);
+    rec.duration_us = elapsedMicros(mhdt->starttime, now);
+    rec.completed = toe == MHD_REQUEST_TERMINATED_COMPLETED_OK;
+    auto len = std::min(mhdt->url.size(), sizeof(rec.path) - 1);
+    memcpy(rec.path, mhdt->url.data(), len);
+    rec.path[len] = 0;
+    ring->push(rec);
+}
+
+static void request_completed_cb(void*, MHD_Connection*, MHDTransaction** con_cls,
+                                 MHD_RequestTerminationCode toe)
+{
+    if (con_cls && *con_cls) {
+        if ((*con_cls)->logged) {
+            accessLogRecord(*con_cls, toe);
+        }
         delete *con_cls;
+    }
 }
 
 
@@ -304,6 +499,10 @@ static MHD_Result answer_to_connection(
         // First call, allocate and set context, get the headers, etc.
         auto mhdt = new MHDTransaction;
         *con_cls = mhdt;
+        if (gAccessLog.load(std::memory_order_relaxed)) {
+            mhdt->logged = true;
+            mhdt->starttime = std::chrono::steady_clock::now();
+        }
         MHD_get_connection_values(conn, MHD_HEADER_KIND, headers_cb, mhdt);
         auto ca = MHD_get_connection_info(conn, MHD_CONNECTION_INFO_CLIENT_ADDRESS)->client_addr;
         mhdt->copyToClientAddress(ca);
@@ -353,6 +552,11 @@ static MHD_Result answer_to_connection(
             return MHD_NO;
         }
         MHD_add_response_header (response, "Location", aurl.c_str());
+        mhdt->httpstatus = 302;
+        mhdt->respsize = 0;
+        if (mhdt->logged) {
+            mhdt->queuedtime = std::chrono::steady_clock::now();
+        }
         MHD_Result ret = MHD_queue_response(conn, 302, response);
         MHD_destroy_response(response);
         return ret;
@@ -409,6 +613,9 @@ static MHD_Result answer_to_connection(
     //MHD_add_response_header(mhdt->response, "Connection", "close");
 
     MHD_get_response_headers (mhdt->response, show_resp_headers_cb, nullptr);
+    if (mhdt->logged) {
+        mhdt->queuedtime = std::chrono::steady_clock::now();
+    }
     MHD_Result ret = MHD_queue_response(conn, mhdt->httpstatus, mhdt->response);
     MHD_destroy_response(mhdt->response);
     return ret;
@@ -421,6 +628,15 @@ static void ssdp_read(SOCKET rsock, fd_set *set)
     }
 }
 
+#ifdef INCLUDE_CLIENT_APIS
+static void event_read(SOCKET rsock, fd_set *set)
+{
+    if (rsock != INVALID_SOCKET && FD_ISSET(rsock, set)) {
+        readFromEventSocket(rsock);
+    }
+}
+#endif /* INCLUDE_CLIENT_APIS */
+
 static int receive_from_stopSock(SOCKET ssock, fd_set *set)
 {
     ssize_t byteReceived;
@@ -478,6 +694,8 @@ void MiniServerJobWorker::work()
         maxMiniSock = std::max(maxMiniSock, miniSocket->ssdpSock6UlaGua);
     }
 #ifdef INCLUDE_CLIENT_APIS
+    maxMiniSock = std::max(maxMiniSock, miniSocket->eventSock4);
+    maxMiniSock = std::max(maxMiniSock, miniSocket->eventSock6);
     for (SOCKET socket : miniSocket->ssdpReqSock4List) {
         maxMiniSock = std::max(maxMiniSock, socket);
     }
@@ -508,6 +726,8 @@ void MiniServerJobWorker::work()
             fdset_if_valid(miniSocket->ssdpSock6UlaGua, &rdSet);
         }
 #ifdef INCLUDE_CLIENT_APIS
+        fdset_if_valid(miniSocket->eventSock4, &rdSet);
+        fdset_if_valid(miniSocket->eventSock6, &rdSet);
         for (SOCKET socket : miniSocket->ssdpReqSock4List) {
             fdset_if_valid(socket, &rdSet);
         }
@@ -534,6 +754,8 @@ void MiniServerJobWorker::work()
 
         // Read select'ed sockets
 #ifdef INCLUDE_CLIENT_APIS
+        event_read(miniSocket->eventSock4, &rdSet);
+        event_read(miniSocket->eventSock6, &rdSet);
         for (SOCKET socket : miniSocket->ssdpReqSock4List) {
             ssdp_read(socket, &rdSet);
         }
@@ -798,7 +1020,13 @@ int StartMiniServer(uint16_t *listen_port4, uint16_t *listen_port6)
     }
     
 #ifdef INTERNAL_WEB_SERVER
-    mhdflags = MHD_USE_THREAD_PER_CONNECTION | MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_DEBUG;
+    if (g_webServerThreads > 0) {
+        // Fixed size thread pool. Suspend/resume is not supported with thread per
+        // connection, and is needed for asynchronous virtual dir reads.
+        mhdflags = MHD_USE_INTERNAL_POLLING_THREAD | MHD_ALLOW_SUSPEND_RESUME | MHD_USE_DEBUG;
+    } else {
+        mhdflags = MHD_USE_THREAD_PER_CONNECTION | MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_DEBUG;
+    }
 
 #ifdef UPNP_ENABLE_IPV6
     if (using_ipv6()) {
@@ -813,6 +1041,9 @@ int StartMiniServer(uint16_t *listen_port4, uint16_t *listen_port6)
         MHD_OPTION_NOTIFY_COMPLETED, request_completed_cb, nullptr,
         MHD_OPTION_CONNECTION_TIMEOUT, static_cast<unsigned int>(HTTP_DEFAULT_TIMEOUT),
         MHD_OPTION_EXTERNAL_LOGGER, mhdlogger, nullptr, 
+        // Thread per connection: end the list here, the pool size is ignored.
+        g_webServerThreads > 0 ? MHD_OPTION_THREAD_POOL_SIZE : MHD_OPTION_END,
+        static_cast<unsigned int>(g_webServerThreads),
         MHD_OPTION_END);
     if (nullptr == mhd) {
         UpnpPrintf(UPNP_CRITICAL, MSERV, __FILE__, __LINE__,
@@ -847,6 +1078,10 @@ int StopMiniServer()
 #ifdef INTERNAL_WEB_SERVER
     MHD_stop_daemon(mhd);
 #endif
+    {
+        std::scoped_lock alck(gAccessLogMutex);
+        gAccessLogRetired.clear();
+    }
 
     sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock == INVALID_SOCKET) {
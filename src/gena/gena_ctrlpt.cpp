@@ -39,12 +39,20 @@
 #include <curl/curl.h>
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <map>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 
 #include "gena.h"
 #include "genut.h"
+#include "propsetparse.h"
 #include "statcodes.h"
 #include "upnpapi.h"
 #include "uri.h"
@@ -184,67 +192,6 @@ static int ScheduleGenaAutoRenew(
 }
 
 
-/*!
- * \brief Sends the UNSUBCRIBE gena request
- *
- * \returns 0 if successful, otherwise returns the appropriate error code.
- */
-static int gena_unsubscribe(
-    /*! [in] Event URL of the service. */
-    const std::string& url,
-    /*! [in] The subcription ID. */
-    const std::string& sid,
-    int timeoutms)
-{
-    int return_code;
-    uri_type dest_url;
-
-    UpnpPrintf(UPNP_ALL,GENA,__FILE__,__LINE__, "gena_unsubscribe: SID [%s] url [%s]\n",
-               sid.c_str(), url.c_str());
-
-    /* parse url */
-    return_code = http_FixStrUrl(url, &dest_url);
-    if (return_code != 0) {
-        return return_code;
-    }
-
-    CURL *easy = curl_easy_init();
-    char curlerrormessage[CURL_ERROR_SIZE];
-    curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, curlerrormessage);
-    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_callback_null_curl);
-    curl_easy_setopt(easy, CURLOPT_CUSTOMREQUEST, "UNSUBSCRIBE");
-    std::string surl =  uri_asurlstr(dest_url);
-    curl_easy_setopt(easy, CURLOPT_URL, surl.c_str());
-    curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, timeoutms);
-
-    struct curl_slist *list = nullptr;
-    list = curl_slist_append(list, (std::string("SID: ") + sid).c_str());
-    list = curl_slist_append(list, (std::string("USER-AGENT: ") + get_sdk_client_info()).c_str());
-    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, list);
-
-    CURLcode code = curl_easy_perform(easy);
-
-    if (code != CURLE_OK) {
-        curl_easy_cleanup(easy);
-        curl_slist_free_all(list);
-        /* We may want to detail things here, depending on the curl error */
-        UpnpPrintf(UPNP_ERROR,GENA,__FILE__,__LINE__, "CURL ERROR MESSAGE %s\n", curlerrormessage);
-        return UPNP_E_SOCKET_CONNECT;
-    }
-
-    long http_status;
-    curl_easy_getinfo (easy, CURLINFO_RESPONSE_CODE, &http_status);
-
-    curl_easy_cleanup(easy);
-    curl_slist_free_all(list);
-
-    if (http_status != HTTP_OK) {
-        return_code = UPNP_E_UNSUBSCRIBE_UNACCEPTED;
-    }
-
-    return return_code;
-}
-
 // localaddr is already in inet_ntop-provided dot or ipv6 format
 static std::string myCallbackUrl(const NetIF::IPAddr& netaddr)
 {
@@ -261,54 +208,55 @@ static std::string myCallbackUrl(const NetIF::IPAddr& netaddr)
     return oss.str();
 }
 
-struct CurlGuard {
-    CurlGuard(CURL* t, curl_slist* l) : htalk(t), hlist(l) {}
-    ~CurlGuard() {
-        if (htalk) {
-            curl_easy_cleanup(htalk);
+/* A SUBSCRIBE (initial or renewal) or UNSUBSCRIBE request. It is set
+   up by prepareSubscribe() or prepareUnsubscribe(), then performed
+   either directly with curl_easy_perform(), or by the asynchronous
+   engine, and the result is processed by subscribeResult() or
+   unsubscribeResult(). */
+struct SubsRequest {
+    SubsRequest() = default;
+    ~SubsRequest() {
+        if (easy) {
+            curl_easy_cleanup(easy);
         }
         if (hlist) {
             curl_slist_free_all(hlist);
         }
     }
-    CurlGuard(const CurlGuard&) = delete;
-    CurlGuard& operator=(const CurlGuard&) = delete;
-    CURL *htalk;
-    struct curl_slist *hlist;
+    SubsRequest(const SubsRequest&) = delete;
+    SubsRequest& operator=(const SubsRequest&) = delete;
+    CURL *easy{nullptr};
+    struct curl_slist *hlist{nullptr};
+    std::string url;
+    std::map<std::string, std::string> http_headers;
+    char curlerrormessage[CURL_ERROR_SIZE];
+    std::string descript;
 };
 
 /*!
- * \brief Subscribes or renew subscription.
+ * \brief Sets up a SUBSCRIBE request, for a new subscription or a renewal.
  *
  * \return 0 if successful, otherwise returns the appropriate error code.
  */
-static int gena_subscribe(
+static int prepareSubscribe(
+    SubsRequest& req,
     /*! [in] URL of service to subscribe. */
     const std::string& url,
-    /*! [in,out] Subscription time desired (in secs). */
-    int *timeout,
+    /*! [in] Subscription time desired (in secs). */
+    int timeout,
     /*! [in] for renewal, this contains a currently held subscription SID.
      * For first time subscription, this must be empty. */
     const std::string& renewal_sid,
-    /*! [out] SID returned by the subscription or renew msg. */
-    std::string *sid,
     int timeoutms)
 {
-    int local_timeout = CP_MINIMUM_SUBSCRIPTION_TIME;
-
-    sid->clear();
-
     /* request timeout to string */
-    if (timeout == nullptr) {
-        timeout = &local_timeout;
-    }
     std::ostringstream timostr;
-    if (*timeout < 0) {
+    if (timeout < 0) {
         timostr << "infinite";
-    } else if (*timeout < CP_MINIMUM_SUBSCRIPTION_TIME) {
+    } else if (timeout < CP_MINIMUM_SUBSCRIPTION_TIME) {
         timostr << CP_MINIMUM_SUBSCRIPTION_TIME;
     } else {
-        timostr << *timeout;
+        timostr << timeout;
     }
 
     /* parse url */
@@ -317,7 +265,7 @@ static int gena_subscribe(
     if (return_code != 0) {
         return return_code;
     }
-    std::string urlforcurl = uri_asurlstr(dest_url);
+    req.url = uri_asurlstr(dest_url);
     NetIF::IPAddr destaddr(reinterpret_cast<struct sockaddr*>(&dest_url.hostport.IPaddress));
 
     // Determine a suitable address for the callback. We choose one on the interface for the
@@ -333,65 +281,79 @@ static int gena_subscribe(
         return UPNP_E_SOCKET_CONNECT;
     }
 
-    std::map<std::string, std::string> http_headers;
-    char curlerrormessage[CURL_ERROR_SIZE];
-
-    auto hdls = CurlGuard(curl_easy_init(), nullptr);
-    curl_easy_setopt(hdls.htalk, CURLOPT_ERRORBUFFER, curlerrormessage);
-    curl_easy_setopt(hdls.htalk, CURLOPT_WRITEFUNCTION, write_callback_null_curl);
-    curl_easy_setopt(hdls.htalk, CURLOPT_CUSTOMREQUEST, "SUBSCRIBE");
-    curl_easy_setopt(hdls.htalk, CURLOPT_URL, urlforcurl.c_str());
-    curl_easy_setopt(hdls.htalk, CURLOPT_TIMEOUT_MS, timeoutms);
-    curl_easy_setopt(hdls.htalk, CURLOPT_HEADERFUNCTION, header_callback_curl);
-    curl_easy_setopt(hdls.htalk, CURLOPT_HEADERDATA, &http_headers);
-    std::string descript;
+    req.easy = curl_easy_init();
+    if (nullptr == req.easy) {
+        return UPNP_E_OUTOF_MEMORY;
+    }
+    curl_easy_setopt(req.easy, CURLOPT_NOSIGNAL, long(1));
+    curl_easy_setopt(req.easy, CURLOPT_ERRORBUFFER, req.curlerrormessage);
+    curl_easy_setopt(req.easy, CURLOPT_WRITEFUNCTION, write_callback_null_curl);
+    curl_easy_setopt(req.easy, CURLOPT_CUSTOMREQUEST, "SUBSCRIBE");
+    curl_easy_setopt(req.easy, CURLOPT_URL, req.url.c_str());
+    curl_easy_setopt(req.easy, CURLOPT_TIMEOUT_MS, timeoutms);
+    curl_easy_setopt(req.easy, CURLOPT_HEADERFUNCTION, header_callback_curl);
+    curl_easy_setopt(req.easy, CURLOPT_HEADERDATA, &req.http_headers);
     if (renewal_sid.empty()) {
         std::string cbheader{"CALLBACK: <"};
         cbheader += myCallbackUrl(myaddr) + "/>";
-        hdls.hlist = curl_slist_append(hdls.hlist, cbheader.c_str());
-        hdls.hlist = curl_slist_append(hdls.hlist, "NT: upnp:event");
-        descript = std::string("(init) ") + "url [" + urlforcurl  + "] cb [" +
+        req.hlist = curl_slist_append(req.hlist, cbheader.c_str());
+        req.hlist = curl_slist_append(req.hlist, "NT: upnp:event");
+        req.descript = std::string("(init) ") + "url [" + req.url  + "] cb [" +
             myCallbackUrl(myaddr) + "] timeout [" + timostr.str() + "]";
-        UpnpPrintf(UPNP_ALL,GENA,__FILE__,__LINE__, "gena_subscribe: %s\n", descript.c_str());
     } else {
-        hdls.hlist = curl_slist_append(
-            hdls.hlist, (std::string("SID: ") + renewal_sid).c_str());
-        descript = std::string("(renew) ") + "url [" + urlforcurl  + "] SID [" +
+        req.hlist = curl_slist_append(
+            req.hlist, (std::string("SID: ") + renewal_sid).c_str());
+        req.descript = std::string("(renew) ") + "url [" + req.url  + "] SID [" +
             renewal_sid + "] timeout [" + timostr.str() + "]";
-        UpnpPrintf(UPNP_ALL,GENA,__FILE__,__LINE__, "gena_subscribe: %s\n", descript.c_str());
     }
-    hdls.hlist = curl_slist_append(
-        hdls.hlist, (std::string("TIMEOUT: Second-") + timostr.str()).c_str());
-    hdls.hlist = curl_slist_append(
-        hdls.hlist, (std::string("USER-AGENT: ")+get_sdk_client_info()).c_str());
-    curl_easy_setopt(hdls.htalk, CURLOPT_HTTPHEADER, hdls.hlist);
+    UpnpPrintf(UPNP_ALL,GENA,__FILE__,__LINE__, "gena_subscribe: %s\n", req.descript.c_str());
+    req.hlist = curl_slist_append(
+        req.hlist, (std::string("TIMEOUT: Second-") + timostr.str()).c_str());
+    req.hlist = curl_slist_append(
+        req.hlist, (std::string("USER-AGENT: ")+get_sdk_client_info()).c_str());
+    curl_easy_setopt(req.easy, CURLOPT_HTTPHEADER, req.hlist);
+    return UPNP_E_SUCCESS;
+}
 
-    CURLcode curlcode = curl_easy_perform(hdls.htalk);
+/*!
+ * \brief Processes the response to a SUBSCRIBE request.
+ *
+ * \return 0 if successful, otherwise returns the appropriate error code.
+ */
+static int subscribeResult(
+    SubsRequest& req,
+    CURLcode curlcode,
+    /*! [out] Subscription time granted by the service. */
+    int *timeout,
+    /*! [out] SID returned by the subscription or renew msg. */
+    std::string *sid)
+{
     if (curlcode != CURLE_OK) {
         /* We may want to detail things here, depending on the curl error */
         UpnpPrintf(UPNP_ERROR,GENA,__FILE__,__LINE__,
-                   "gena_subscribe: %s: CURL ERROR MESSAGE %s\n", descript.c_str(),curlerrormessage);
+                   "gena_subscribe: %s: CURL ERROR MESSAGE %s\n", req.descript.c_str(),
+                   req.curlerrormessage);
         return UPNP_E_SOCKET_CONNECT;
     }
 
     long http_status;
-    curl_easy_getinfo (hdls.htalk, CURLINFO_RESPONSE_CODE, &http_status);
+    curl_easy_getinfo (req.easy, CURLINFO_RESPONSE_CODE, &http_status);
     if (http_status != HTTP_OK) {
         UpnpPrintf(UPNP_DEBUG,GENA,__FILE__,__LINE__,
-                   "gena_subscribe: %s: HTTP status %d\n", descript.c_str(), int(http_status));
+                   "gena_subscribe: %s: HTTP status %d\n", req.descript.c_str(), int(http_status));
         return UPNP_E_SUBSCRIBE_UNACCEPTED;
     }
 
     /* get SID and TIMEOUT. the header callback lowercases the header names */
-    const auto itsid = http_headers.find("sid");
-    const auto ittimeout = http_headers.find("timeout");
-    if (itsid == http_headers.end() || ittimeout == http_headers.end()) {
+    const auto itsid = req.http_headers.find("sid");
+    const auto ittimeout = req.http_headers.find("timeout");
+    if (itsid == req.http_headers.end() || ittimeout == req.http_headers.end()) {
         UpnpPrintf(UPNP_DEBUG,GENA,__FILE__,__LINE__, "Subscribe error: no SID in answer\n");
         return UPNP_E_BAD_RESPONSE;
     }
 
     /* save timeout */
-    if (!timeout_header_value(http_headers, timeout)) {
+    if (!timeout_header_value(req.http_headers, timeout)) {
         UpnpPrintf(UPNP_DEBUG,GENA,__FILE__,__LINE__, "Subscribe error: no timeout in answer\n");
         return UPNP_E_BAD_RESPONSE;
     }
@@ -404,26 +366,148 @@ static int gena_subscribe(
     return UPNP_E_SUCCESS;
 }
 
+/*!
+ * \brief Subscribes or renew subscription.
+ *
+ * \return 0 if successful, otherwise returns the appropriate error code.
+ */
+static int gena_subscribe(
+    /*! [in] URL of service to subscribe. */
+    const std::string& url,
+    /*! [in,out] Subscription time desired (in secs). */
+    int *timeout,
+    /*! [in] for renewal, this contains a currently held subscription SID.
+     * For first time subscription, this must be empty. */
+    const std::string& renewal_sid,
+    /*! [out] SID returned by the subscription or renew msg. */
+    std::string *sid,
+    int timeoutms)
+{
+    int local_timeout = CP_MINIMUM_SUBSCRIPTION_TIME;
+
+    sid->clear();
+    if (timeout == nullptr) {
+        timeout = &local_timeout;
+    }
+    SubsRequest req;
+    int return_code = prepareSubscribe(req, url, *timeout, renewal_sid, timeoutms);
+    if (return_code != UPNP_E_SUCCESS) {
+        return return_code;
+    }
+    CURLcode curlcode = curl_easy_perform(req.easy);
+    return subscribeResult(req, curlcode, timeout, sid);
+}
+
+/*!
+ * \brief Sets up an UNSUBSCRIBE request.
+ *
+ * \returns 0 if successful, otherwise returns the appropriate error code.
+ */
+static int prepareUnsubscribe(
+    SubsRequest& req,
+    /*! [in] Event URL of the service. */
+    const std::string& url,
+    /*! [in] The subcription ID. */
+    const std::string& sid,
+    int timeoutms)
+{
+    UpnpPrintf(UPNP_ALL,GENA,__FILE__,__LINE__, "gena_unsubscribe: SID [%s] url [%s]\n",
+               sid.c_str(), url.c_str());
+
+    /* parse url */
+    uri_type dest_url;
+    int return_code = http_FixStrUrl(url, &dest_url);
+    if (return_code != 0) {
+        return return_code;
+    }
+
+    req.easy = curl_easy_init();
+    if (nullptr == req.easy) {
+        return UPNP_E_OUTOF_MEMORY;
+    }
+    req.url = uri_asurlstr(dest_url);
+    curl_easy_setopt(req.easy, CURLOPT_NOSIGNAL, long(1));
+    curl_easy_setopt(req.easy, CURLOPT_ERRORBUFFER, req.curlerrormessage);
+    curl_easy_setopt(req.easy, CURLOPT_WRITEFUNCTION, write_callback_null_curl);
+    curl_easy_setopt(req.easy, CURLOPT_CUSTOMREQUEST, "UNSUBSCRIBE");
+    curl_easy_setopt(req.easy, CURLOPT_URL, req.url.c_str());
+    curl_easy_setopt(req.easy, CURLOPT_TIMEOUT_MS, timeoutms);
+
+    req.hlist = curl_slist_append(req.hlist, (std::string("SID: ") + sid).c_str());
+    req.hlist = curl_slist_append(
+        req.hlist, (std::string("USER-AGENT: ") + get_sdk_client_info()).c_str());
+    curl_easy_setopt(req.easy, CURLOPT_HTTPHEADER, req.hlist);
+    return UPNP_E_SUCCESS;
+}
+
+/*!
+ * \brief Processes the response to an UNSUBSCRIBE request.
+ *
+ * \returns 0 if successful, otherwise returns the appropriate error code.
+ */
+static int unsubscribeResult(SubsRequest& req, CURLcode code)
+{
+    if (code != CURLE_OK) {
+        /* We may want to detail things here, depending on the curl error */
+        UpnpPrintf(UPNP_ERROR,GENA,__FILE__,__LINE__, "CURL ERROR MESSAGE %s\n",
+                   req.curlerrormessage);
+        return UPNP_E_SOCKET_CONNECT;
+    }
+
+    long http_status;
+    curl_easy_getinfo (req.easy, CURLINFO_RESPONSE_CODE, &http_status);
+    if (http_status != HTTP_OK) {
+        return UPNP_E_UNSUBSCRIBE_UNACCEPTED;
+    }
+    return UPNP_E_SUCCESS;
+}
+
+/*!
+ * \brief Sends the UNSUBCRIBE gena request
+ *
+ * \returns 0 if successful, otherwise returns the appropriate error code.
+ */
+static int gena_unsubscribe(
+    /*! [in] Event URL of the service. */
+    const std::string& url,
+    /*! [in] The subcription ID. */
+    const std::string& sid,
+    int timeoutms)
+{
+    SubsRequest req;
+    int return_code = prepareUnsubscribe(req, url, sid, timeoutms);
+    if (return_code != UPNP_E_SUCCESS) {
+        return return_code;
+    }
+    CURLcode code = curl_easy_perform(req.easy);
+    return unsubscribeResult(req, code);
+}
+
+static void drainSubsOperations(UpnpClient_Handle client_handle);
 
 int genaUnregisterClient(UpnpClient_Handle client_handle)
 {
     struct Handle_Info *handle_info;
     int timeoutms;
     ClientSubscription sub_copy;
-    
+
+    /* Wait for the asynchronous operations in progress, so that the
+       subscriptions they create are in the table and get cancelled */
+    drainSubsOperations(client_handle);
     while (true) {
         {
-            HANDLELOCK();
+            HANDLELOCK_SHARED();
 
             if (GetHandleInfo(client_handle, &handle_info) != HND_CLIENT) {
                 return UPNP_E_INVALID_HANDLE;
             }
-            if (handle_info->ClientSubList.empty()) {
+            std::scoped_lock lck(handle_info->ClientSubs.mutex);
+            auto& subs = handle_info->ClientSubs.bySid;
+            if (subs.empty()) {
                 break;
             }
-            sub_copy = handle_info->ClientSubList.front();
-            handle_info->ClientSubList.remove_if(
-                [sub_copy] (const ClientSubscription& e) {return e.SID == sub_copy.SID;});
+            sub_copy = subs.begin()->second;
+            subs.erase(subs.begin());
 
             timeoutms = handle_info->SubsOpsTimeoutMS;
         }
@@ -436,37 +520,129 @@ int genaUnregisterClient(UpnpClient_Handle client_handle)
 }
 
 
-int genaUnSubscribe(UpnpClient_Handle client_handle, const std::string& in_sid)
+/* Look up a subscription for an unsubscribe or renewal, and copy it.
+   If cancelrenew is set, the renewal timer is removed. */
+static int startSubsOperation(
+    UpnpClient_Handle client_handle, const std::string& in_sid, ClientSubscription& sub_copy,
+    int& timeoutms, bool cancelrenew)
 {
     struct Handle_Info *handle_info;
-    int timeoutms;
-    ClientSubscription sub_copy;
-    {
-        /* validate handle and sid */
-        HANDLELOCK();
-        if (GetHandleInfo(client_handle, &handle_info) != HND_CLIENT) {
-            return UPNP_E_INVALID_HANDLE;
-        }
-        auto sub = std::find_if(handle_info->ClientSubList.begin(), handle_info->ClientSubList.end(),
-                                [in_sid](const ClientSubscription& e){return e.SID == in_sid;});
-        if (handle_info->ClientSubList.end() == sub) {
-            return UPNP_E_INVALID_SID;
-        }
-        timeoutms = handle_info->SubsOpsTimeoutMS;
-        sub_copy = *sub;
+
+    /* validate handle and sid */
+    HANDLELOCK_SHARED();
+    if (GetHandleInfo(client_handle, &handle_info) != HND_CLIENT) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    std::scoped_lock lck(handle_info->ClientSubs.mutex);
+    auto sub = handle_info->ClientSubs.bySid.find(in_sid);
+    if (handle_info->ClientSubs.bySid.end() == sub) {
+        return UPNP_E_INVALID_SID;
+    }
+    timeoutms = handle_info->SubsOpsTimeoutMS;
+    if (cancelrenew) {
+        /* remove old events */
+        gTimerThread->remove(sub->second.renewEventId);
+        sub->second.renewEventId = -1;
     }
+    sub_copy = sub->second;
+    return UPNP_E_SUCCESS;
+}
+
+/* Remove a subscription after the UNSUBSCRIBE request */
+static int unsubscribeDone(
+    UpnpClient_Handle client_handle, const std::string& in_sid, ClientSubscription& sub_copy)
+{
+    struct Handle_Info *handle_info;
 
-    gena_unsubscribe(sub_copy.eventURL, sub_copy.SID, timeoutms);
     clientCancelRenew(&sub_copy);
+    HANDLELOCK_SHARED();
+    if (GetHandleInfo(client_handle, &handle_info) != HND_CLIENT) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    std::scoped_lock lck(handle_info->ClientSubs.mutex);
+    handle_info->ClientSubs.bySid.erase(in_sid);
+    return UPNP_E_SUCCESS;
+}
+
+/* Record a new subscription and schedule its renewal */
+static int addClientSubscription(
+    UpnpClient_Handle client_handle, const std::string& PublisherURL, const std::string& SID,
+    int TimeOut)
+{
+    struct Handle_Info *handle_info;
+
+    HANDLELOCK_SHARED();
+    if(GetHandleInfo(client_handle, &handle_info) != HND_CLIENT) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    std::scoped_lock lck(handle_info->ClientSubs.mutex);
+    auto& sub = handle_info->ClientSubs.bySid[SID];
+    sub = ClientSubscription(-1, SID, PublisherURL);
+
+    /* schedule expiration event */
+    return ScheduleGenaAutoRenew(client_handle, TimeOut, &sub);
+}
+
+/* Update a subscription after the renewal request, or remove it if
+   this failed */
+static int renewDone(
+    UpnpClient_Handle client_handle, const std::string& in_sid, int return_code,
+    const std::string& SID, int TimeOut, ClientSubscription& sub_copy)
+{
+    struct Handle_Info *handle_info;
+
+    HANDLELOCK_SHARED();
 
-    HANDLELOCK();
     if (GetHandleInfo(client_handle, &handle_info) != HND_CLIENT) {
         return UPNP_E_INVALID_HANDLE;
     }
-    handle_info->ClientSubList.remove_if(
-        [in_sid] (const ClientSubscription& e) {return e.SID == in_sid;});
+    std::scoped_lock lck(handle_info->ClientSubs.mutex);
+    auto& subs = handle_info->ClientSubs.bySid;
 
-    return UPNP_E_SUCCESS;
+    if (return_code != UPNP_E_SUCCESS) {
+        /* network failure (remove client sub) */
+        subs.erase(in_sid);
+        clientCancelRenew(&sub_copy);
+        return return_code;
+    }
+
+    /* get subscription */
+    auto sub = subs.find(in_sid);
+    if (subs.end() == sub) {
+        clientCancelRenew(&sub_copy);
+        return UPNP_E_INVALID_SID;
+    }
+
+    /* Remember SID. The device should not change it, but if it does,
+       the subscription must be indexed by the new one. */
+    if (SID != in_sid) {
+        auto node = subs.extract(sub);
+        node.key() = SID;
+        node.mapped().SID = SID;
+        sub = subs.insert(std::move(node)).position;
+    }
+
+    /* start renew subscription timer */
+    return_code = ScheduleGenaAutoRenew(client_handle, TimeOut, &sub->second);
+    if (return_code != UPNP_E_SUCCESS) {
+        subs.erase(sub);
+    }
+    clientCancelRenew(&sub_copy);
+
+    return return_code;
+}
+
+int genaUnSubscribe(UpnpClient_Handle client_handle, const std::string& in_sid)
+{
+    int timeoutms;
+    ClientSubscription sub_copy;
+    int return_code = startSubsOperation(client_handle, in_sid, sub_copy, timeoutms, false);
+    if (return_code != UPNP_E_SUCCESS) {
+        return return_code;
+    }
+
+    gena_unsubscribe(sub_copy.eventURL, sub_copy.SID, timeoutms);
+    return unsubscribeDone(client_handle, in_sid, sub_copy);
 }
 
 
@@ -478,14 +654,13 @@ int genaSubscribe(
 {
     int return_code = UPNP_E_SUCCESS;
     std::string SID;
-    std::string EventURL;
     struct Handle_Info *handle_info;
     int timeoutms;
     
     out_sid->clear();
 
     {
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         /* validate handle */
         if (GetHandleInfo(client_handle, &handle_info) != HND_CLIENT) {
             return UPNP_E_INVALID_HANDLE;
@@ -499,27 +674,10 @@ int genaSubscribe(
     if (return_code != UPNP_E_SUCCESS) {
         UpnpPrintf(UPNP_ERROR, GENA, __FILE__, __LINE__,
                    "genaSubscribe: subscribe error, return %d\n", return_code);
-        goto error_handler;
-    }
-
-    {
-        HANDLELOCK();
-        if(GetHandleInfo(client_handle, &handle_info) != HND_CLIENT) {
-            return_code = UPNP_E_INVALID_HANDLE;
-            goto error_handler;
-        }
-
-        /* create event url */
-        EventURL = PublisherURL;
+    } else {
         out_sid->assign(SID);
-        handle_info->ClientSubList.emplace_front(-1, std::move(SID), std::move(EventURL));
-
-        /* schedule expiration event */
-        return_code = ScheduleGenaAutoRenew(client_handle, *TimeOut,
-                                            &handle_info->ClientSubList.front());
+        return_code = addClientSubscription(client_handle, PublisherURL, SID, *TimeOut);
     }
-
-error_handler:
     SubscribeUnlock();
     return return_code;
 }
@@ -530,67 +688,491 @@ int genaRenewSubscription(
     const std::string& in_sid,
     int *TimeOut)
 {
-    struct Handle_Info *handle_info;
     int timeoutms;
     ClientSubscription sub_copy;
+    int return_code = startSubsOperation(client_handle, in_sid, sub_copy, timeoutms, true);
+    if (return_code != UPNP_E_SUCCESS) {
+        return return_code;
+    }
+
+    std::string SID;
+    return_code = gena_subscribe(sub_copy.eventURL, TimeOut, sub_copy.SID, &SID, timeoutms);
+    return renewDone(client_handle, in_sid, return_code, SID, *TimeOut, sub_copy);
+}
+
+
+/* Asynchronous subscription operations */
+
+struct SubsOperation {
+    Upnp_EventType type; // UPNP_EVENT_SUBSCRIBE/RENEWAL/UNSUBSCRIBE_COMPLETE
+    UpnpClient_Handle handle;
+    Upnp_FunPtr callback;
+    void *cookie;
+    std::string url;
+    std::string sid;
+    int timeout;
+    ClientSubscription sub_copy{-1, std::string(), std::string()};
+    SubsRequest req;
+};
+
+/* Initial subscriptions in progress. The first event may arrive
+   before the response to the SUBSCRIBE request is processed, and the
+   notification handler must not reject it. The synchronous version
+   uses SubscribeLock for this, the asynchronous one lets the handler
+   wait for the pending subscriptions to complete. */
+static std::mutex pendingSubsMutex;
+static std::condition_variable pendingSubsCv;
+static int pendingSubs;
+static uint64_t pendingSubsDone;
+
+static void pendingSubscribeDone()
+{
     {
-        HANDLELOCK();
+        std::scoped_lock lck(pendingSubsMutex);
+        if (pendingSubs > 0)
+            pendingSubs--;
+        pendingSubsDone++;
+    }
+    pendingSubsCv.notify_all();
+}
 
-        /* validate handle and sid */
-        if (GetHandleInfo(client_handle, &handle_info) != HND_CLIENT) {
-            return UPNP_E_INVALID_HANDLE;
+/* Check that we have a subscription for a SID. Called with the handle lock held */
+static bool hasClientSubscription(struct Handle_Info *handle_info, const std::string& sid)
+{
+    std::scoped_lock lck(handle_info->ClientSubs.mutex);
+    return handle_info->ClientSubs.bySid.find(sid) != handle_info->ClientSubs.bySid.end();
+}
+
+/* Called by the notification handler, without the handle lock, for an
+   initial event with an unknown SID. Wait until the subscription appears,
+   or there are no asynchronous subscriptions in progress any more. */
+static void waitPendingSubscribes(const std::string& sid)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(HTTP_DEFAULT_TIMEOUT * 1000);
+    std::unique_lock<std::mutex> lck(pendingSubsMutex);
+    while (pendingSubs > 0) {
+        auto done = pendingSubsDone;
+        if (!pendingSubsCv.wait_until(lck, deadline, [done] {return pendingSubsDone != done;})) {
+            return;
         }
+        lck.unlock();
+        {
+            HANDLELOCK_SHARED();
+            struct Handle_Info *handle_info;
+            UpnpClient_Handle client_handle;
+            if (GetClientHandleInfo(&client_handle, &handle_info) != HND_CLIENT ||
+                hasClientSubscription(handle_info, sid)) {
+                return;
+            }
+        }
+        lck.lock();
+    }
+}
 
-        auto sub = std::find_if(handle_info->ClientSubList.begin(), handle_info->ClientSubList.end(),
-                                [in_sid](const ClientSubscription& e){return e.SID == in_sid;});
-        if (handle_info->ClientSubList.end() == sub) {
-            return UPNP_E_INVALID_SID;
+class SubsOpCallbackJobWorker : public JobWorker {
+public:
+    SubsOpCallbackJobWorker(UpnpClient_Handle handle, Upnp_EventType type,
+                            const Upnp_Event_Subscribe& event, Upnp_FunPtr callback, void *cookie)
+        : m_handle(handle), m_type(type), m_event(event), m_callback(callback),
+          m_cookie(cookie) {}
+    void work() override {
+        {
+            /* No callback after the client was unregistered */
+            HANDLELOCK_SHARED();
+            struct Handle_Info *handle_info;
+            if (GetHandleInfo(m_handle, &handle_info) != HND_CLIENT) {
+                return;
+            }
         }
-        timeoutms = handle_info->SubsOpsTimeoutMS;
+        m_callback(m_type, &m_event, m_cookie);
+    }
+private:
+    UpnpClient_Handle m_handle;
+    Upnp_EventType m_type;
+    Upnp_Event_Subscribe m_event;
+    Upnp_FunPtr m_callback;
+    void *m_cookie;
+};
 
-        /* remove old events */
-        gTimerThread->remove(sub->renewEventId);
+static int submitSubsOperation(std::unique_ptr<SubsOperation> op);
 
-        sub->renewEventId = -1;
-        sub_copy = *sub;
+/* Cancel a subscription which was granted after the client handle went
+   away, so that it does not stay on the device until it expires. */
+static void unsubscribeOrphan(UpnpClient_Handle client_handle, const std::string& url,
+                              const std::string& sid)
+{
+    UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
+               "Client gone, cancelling subscription %s\n", sid.c_str());
+    auto op = std::make_unique<SubsOperation>();
+    op->type = UPNP_EVENT_UNSUBSCRIBE_COMPLETE;
+    op->handle = client_handle;
+    op->callback = nullptr;
+    op->cookie = nullptr;
+    op->url = url;
+    op->sid = sid;
+    op->timeout = 0;
+    if (prepareUnsubscribe(op->req, url, sid, HTTP_DEFAULT_TIMEOUT * 1000) == UPNP_E_SUCCESS) {
+        submitSubsOperation(std::move(op));
     }
+}
 
+/* Process the result of an operation and queue the application callback.
+   Called from the engine thread, without any lock held */
+static void subsOperationDone(std::unique_ptr<SubsOperation> op, CURLcode code)
+{
+    struct Upnp_Event_Subscribe event;
     std::string SID;
-    int return_code = gena_subscribe(sub_copy.eventURL, TimeOut, sub_copy.SID, &SID, timeoutms);
+    int timeout = op->timeout;
+    int return_code;
+    switch (op->type) {
+    case UPNP_EVENT_SUBSCRIBE_COMPLETE:
+        return_code = subscribeResult(op->req, code, &timeout, &SID);
+        if (return_code == UPNP_E_SUCCESS) {
+            return_code = addClientSubscription(op->handle, op->url, SID, timeout);
+            if (return_code == UPNP_E_INVALID_HANDLE) {
+                unsubscribeOrphan(op->handle, op->url, SID);
+            }
+        }
+        pendingSubscribeDone();
+        break;
+    case UPNP_EVENT_RENEWAL_COMPLETE:
+        return_code = subscribeResult(op->req, code, &timeout, &SID);
+        return_code = renewDone(op->handle, op->sid, return_code, SID, timeout, op->sub_copy);
+        if (return_code != UPNP_E_SUCCESS) {
+            SID = op->sid;
+        }
+        break;
+    default:
+        return_code = unsubscribeResult(op->req, code);
+        unsubscribeDone(op->handle, op->sid, op->sub_copy);
+        SID = op->sid;
+        break;
+    }
+    event.Sid = SID;
+    event.ErrCode = return_code;
+    upnp_strlcpy(event.PublisherUrl, op->url, NAME_SIZE);
+    event.TimeOut = timeout;
+    UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__, "subsOperationDone: type %d status %d\n",
+               op->type, return_code);
+    if (nullptr == op->callback) {
+        return;
+    }
+    gRecvThreadPool.addJob(std::make_unique<SubsOpCallbackJobWorker>(
+                               op->handle, op->type, event, op->callback, op->cookie));
+}
+
+/*!
+ * \brief Performs the asynchronous subscription operations.
+ *
+ * Like the device notification engine, a single thread drives the
+ * requests with a curl multi handle, so that many subscriptions can
+ * proceed in parallel without using a thread each. At most
+ * GENA_CP_MAX_PARALLEL_SUBSCRIPTIONS requests are in progress, the
+ * others wait in the queue.
+ */
+class SubsOpsEngine {
+public:
+    int start();
+    void stop();
+    int submit(std::unique_ptr<SubsOperation> op);
+    /* Discard the queued operations for a client, and wait for the
+       ones in progress to complete */
+    void drain(UpnpClient_Handle handle);
+
+private:
+    void run();
+    void operationDone(std::unique_ptr<SubsOperation> op, CURLcode code);
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    /* Protected by m_mutex */
+    CURLM *m_multi{nullptr};
+    bool m_stop{false};
+    std::deque<std::unique_ptr<SubsOperation>> m_queue;
+    /* Operations taken from the queue and not completed, per client */
+    std::unordered_map<UpnpClient_Handle, int> m_inprogress;
+    /* Only accessed from the engine thread */
+    std::unordered_map<CURL*, std::unique_ptr<SubsOperation>> m_active;
+};
+
+static SubsOpsEngine subsOpsEngine;
+
+int SubsOpsEngine::start()
+{
+    std::scoped_lock lck(m_mutex);
+    if (m_multi) {
+        return UPNP_E_SUCCESS;
+    }
+    m_multi = curl_multi_init();
+    if (nullptr == m_multi) {
+        return UPNP_E_INIT_FAILED;
+    }
+    m_stop = false;
+    m_thread = std::thread(&SubsOpsEngine::run, this);
+    return UPNP_E_SUCCESS;
+}
 
-    HANDLELOCK();
+void SubsOpsEngine::stop()
+{
+    {
+        std::scoped_lock lck(m_mutex);
+        if (nullptr == m_multi) {
+            return;
+        }
+        m_stop = true;
+#if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_wakeup(m_multi);
+#endif
+    }
+    m_cv.notify_all();
+    m_thread.join();
+    std::scoped_lock lck(m_mutex);
+    // Pending and active operations are discarded: the client is gone.
+    m_queue.clear();
+    for (auto& [easy, op] : m_active) {
+        curl_multi_remove_handle(m_multi, easy);
+    }
+    m_active.clear();
+    m_inprogress.clear();
+    curl_multi_cleanup(m_multi);
+    m_multi = nullptr;
+    {
+        std::scoped_lock plck(pendingSubsMutex);
+        pendingSubs = 0;
+    }
+    pendingSubsCv.notify_all();
+}
+
+int SubsOpsEngine::submit(std::unique_ptr<SubsOperation> op)
+{
+    std::scoped_lock lck(m_mutex);
+    if (nullptr == m_multi || m_stop) {
+        return UPNP_E_FINISH;
+    }
+    if (op->type == UPNP_EVENT_SUBSCRIBE_COMPLETE) {
+        std::scoped_lock plck(pendingSubsMutex);
+        pendingSubs++;
+    }
+    m_queue.push_back(std::move(op));
+#if LIBCURL_VERSION_NUM >= 0x074400
+    curl_multi_wakeup(m_multi);
+#endif
+    return UPNP_E_SUCCESS;
+}
+
+void SubsOpsEngine::drain(UpnpClient_Handle handle)
+{
+    std::deque<std::unique_ptr<SubsOperation>> discarded;
+    {
+        std::unique_lock lck(m_mutex);
+        for (auto it = m_queue.begin(); it != m_queue.end();) {
+            if ((*it)->handle == handle) {
+                discarded.push_back(std::move(*it));
+                it = m_queue.erase(it);
+            } else {
+                it++;
+            }
+        }
+        m_cv.wait(lck, [this, handle] {
+            return m_stop || m_inprogress.find(handle) == m_inprogress.end();});
+    }
+    for (const auto& op : discarded) {
+        if (op->type == UPNP_EVENT_SUBSCRIBE_COMPLETE) {
+            pendingSubscribeDone();
+        }
+    }
+}
+
+/* Called from the engine thread, without the lock */
+void SubsOpsEngine::operationDone(std::unique_ptr<SubsOperation> op, CURLcode code)
+{
+    auto handle = op->handle;
+    subsOperationDone(std::move(op), code);
+    {
+        std::scoped_lock lck(m_mutex);
+        auto it = m_inprogress.find(handle);
+        if (it != m_inprogress.end() && --it->second <= 0) {
+            m_inprogress.erase(it);
+        }
+    }
+    m_cv.notify_all();
+}
 
+void SubsOpsEngine::run()
+{
+    std::vector<std::unique_ptr<SubsOperation>> failed;
+    for (;;) {
+        {
+            std::scoped_lock lck(m_mutex);
+            if (m_stop) {
+                break;
+            }
+            while (!m_queue.empty() && m_active.size() < GENA_CP_MAX_PARALLEL_SUBSCRIPTIONS) {
+                auto op = std::move(m_queue.front());
+                m_queue.pop_front();
+                m_inprogress[op->handle]++;
+                CURL *easy = op->req.easy;
+                if (curl_multi_add_handle(m_multi, easy) != CURLM_OK) {
+                    failed.push_back(std::move(op));
+                    continue;
+                }
+                m_active[easy] = std::move(op);
+            }
+        }
+        for (auto& op : failed) {
+            operationDone(std::move(op), CURLE_FAILED_INIT);
+        }
+        failed.clear();
+
+        int running;
+        curl_multi_perform(m_multi, &running);
+        CURLMsg *msg;
+        int msgsleft;
+        while ((msg = curl_multi_info_read(m_multi, &msgsleft))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            auto it = m_active.find(msg->easy_handle);
+            if (it == m_active.end()) {
+                continue;
+            }
+            auto op = std::move(it->second);
+            m_active.erase(it);
+            CURLcode code = msg->data.result;
+            curl_multi_remove_handle(m_multi, op->req.easy);
+            operationDone(std::move(op), code);
+        }
+
+#if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_poll(m_multi, nullptr, 0, 1000, nullptr);
+#else
+        // No wakeup call in this curl version: poll the submission queue.
+        curl_multi_wait(m_multi, nullptr, 0, 50, nullptr);
+#endif
+    }
+}
+
+int genaSubsOpsEngineStart()
+{
+    return subsOpsEngine.start();
+}
+
+void genaSubsOpsEngineStop()
+{
+    subsOpsEngine.stop();
+}
+
+static int submitSubsOperation(std::unique_ptr<SubsOperation> op)
+{
+    return subsOpsEngine.submit(std::move(op));
+}
+
+static void drainSubsOperations(UpnpClient_Handle client_handle)
+{
+    subsOpsEngine.drain(client_handle);
+}
+
+/* Create an operation, with the callback defaulting to the handle's */
+static std::unique_ptr<SubsOperation> newSubsOperation(
+    UpnpClient_Handle client_handle, Upnp_EventType type, Upnp_FunPtr callback,
+    const void *cookie, int& timeoutms)
+{
+    struct Handle_Info *handle_info;
+    HANDLELOCK_SHARED();
     if (GetHandleInfo(client_handle, &handle_info) != HND_CLIENT) {
-        return UPNP_E_INVALID_HANDLE;
+        return nullptr;
     }
+    auto op = std::make_unique<SubsOperation>();
+    op->type = type;
+    op->handle = client_handle;
+    if (callback) {
+        op->callback = callback;
+        op->cookie = const_cast<void*>(cookie);
+    } else {
+        op->callback = handle_info->Callback;
+        op->cookie = handle_info->Cookie;
+    }
+    timeoutms = handle_info->SubsOpsTimeoutMS;
+    return op;
+}
 
+int genaSubscribeAsync(
+    UpnpClient_Handle client_handle, const std::string& PublisherURL, int TimeOut,
+    Upnp_FunPtr callback, const void *cookie)
+{
+    int timeoutms;
+    auto op = newSubsOperation(
+        client_handle, UPNP_EVENT_SUBSCRIBE_COMPLETE, callback, cookie, timeoutms);
+    if (!op) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    op->url = PublisherURL;
+    op->timeout = TimeOut;
+    int return_code = prepareSubscribe(op->req, PublisherURL, TimeOut, std::string(), timeoutms);
     if (return_code != UPNP_E_SUCCESS) {
-        /* network failure (remove client sub) */
-        handle_info->ClientSubList.remove_if(
-            [in_sid] (const ClientSubscription& e) {return e.SID == in_sid;});
-        clientCancelRenew(&sub_copy);
         return return_code;
     }
+    return subsOpsEngine.submit(std::move(op));
+}
 
-    /* get subscription */
-    auto sub = std::find_if(handle_info->ClientSubList.begin(), handle_info->ClientSubList.end(),
-                            [in_sid](const ClientSubscription& e){return e.SID == in_sid;});
-    if (handle_info->ClientSubList.end() == sub) {
-        clientCancelRenew(&sub_copy);
-        return UPNP_E_INVALID_SID;
+int genaRenewSubscriptionAsync(
+    UpnpClient_Handle client_handle, const std::string& in_sid, int TimeOut,
+    Upnp_FunPtr callback, const void *cookie)
+{
+    int timeoutms;
+    auto op = newSubsOperation(
+        client_handle, UPNP_EVENT_RENEWAL_COMPLETE, callback, cookie, timeoutms);
+    if (!op) {
+        return UPNP_E_INVALID_HANDLE;
     }
-
-    /* Remember SID */
-    sub->SID = SID;
-
-    /* start renew subscription timer */
-    return_code = ScheduleGenaAutoRenew(client_handle, *TimeOut, &*sub);
+    int return_code = startSubsOperation(client_handle, in_sid, op->sub_copy, timeoutms, true);
     if (return_code != UPNP_E_SUCCESS) {
-        handle_info->ClientSubList.remove_if(
-            [sub] (const ClientSubscription& e) {return e.SID == sub->SID;});
+        return return_code;
     }
-    clientCancelRenew(&sub_copy);
+    op->sid = in_sid;
+    op->url = op->sub_copy.eventURL;
+    op->timeout = TimeOut;
+    return_code = prepareSubscribe(op->req, op->url, TimeOut, in_sid, timeoutms);
+    if (return_code == UPNP_E_SUCCESS) {
+        return_code = subsOpsEngine.submit(std::move(op));
+    }
+    if (return_code != UPNP_E_SUCCESS) {
+        // The renewal timer was removed, drop the subscription like a failed renewal
+        ClientSubscription sub_copy(-1, std::string(), std::string());
+        renewDone(client_handle, in_sid, return_code, std::string(), TimeOut, sub_copy);
+    }
+    return return_code;
+}
 
+int genaUnSubscribeAsync(
+    UpnpClient_Handle client_handle, const std::string& in_sid,
+    Upnp_FunPtr callback, const void *cookie)
+{
+    int timeoutms;
+    auto op = newSubsOperation(
+        client_handle, UPNP_EVENT_UNSUBSCRIBE_COMPLETE, callback, cookie, timeoutms);
+    if (!op) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    // No renewal while the request is waiting or in progress
+    int return_code = startSubsOperation(client_handle, in_sid, op->sub_copy, timeoutms, true);
+    if (return_code != UPNP_E_SUCCESS) {
+        return return_code;
+    }
+    op->sid = in_sid;
+    op->url = op->sub_copy.eventURL;
+    op->timeout = 0;
+    return_code = prepareUnsubscribe(op->req, op->url, in_sid, timeoutms);
+    if (return_code == UPNP_E_SUCCESS) {
+        return_code = subsOpsEngine.submit(std::move(op));
+    }
+    if (return_code != UPNP_E_SUCCESS) {
+        // Like the synchronous version, forget about it anyway
+        ClientSubscription sub_copy(-1, std::string(), std::string());
+        unsubscribeDone(client_handle, in_sid, sub_copy);
+    }
     return return_code;
 }
 
@@ -679,59 +1261,66 @@ void gena_process_notification_event(MHDTransaction *mhdt)
                    "gena_process_notification_event: empty or not xml\n");
         return;
     }
+    /* Try the in-place parser first, the full XML parser is only
+       needed for unusual documents */
+    propsetparse::PropertyViews views;
+    views.reserve(8);
     std::unordered_map<std::string, std::string> propset;
-    UPnPPropertysetParser parser(mhdt->postdata, propset);
-    if (!parser.Parse()) {
-        http_SendStatusResponse(mhdt, HTTP_BAD_REQUEST);
-        UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__,
-                   "gena_process_notification_event: xml parse failed: [%s]\n",
-                   mhdt->postdata.c_str());
-        return;
+    bool inplace = propsetparse::parseInPlace(mhdt->postdata, views);
+    if (!inplace) {
+        views.clear();
+        UPnPPropertysetParser parser(mhdt->postdata, propset);
+        if (!parser.Parse()) {
+            http_SendStatusResponse(mhdt, HTTP_BAD_REQUEST);
+            UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__,
+                       "gena_process_notification_event: xml parse failed: [%s]\n",
+                       mhdt->postdata.c_str());
+            return;
+        }
     }
-    globalHndLock.lock();
+    /* The handle lock is only taken shared: the subscription table
+       has its own mutex. */
+    globalHndLock.lock_shared();
 
     /* get client info */
     struct Handle_Info *handle_info;
     UpnpClient_Handle client_handle;
     if (GetClientHandleInfo(&client_handle, &handle_info) != HND_CLIENT) {
         http_SendStatusResponse(mhdt, HTTP_PRECONDITION_FAILED);
-        globalHndLock.unlock();
+        globalHndLock.unlock_shared();
         return;
     }
 
     /* get subscription based on SID */
-    auto subscription = std::find_if(
-        handle_info->ClientSubList.begin(), handle_info->ClientSubList.end(),
-        [sid](const ClientSubscription& e){return e.SID == sid;});
-    if (handle_info->ClientSubList.end() == subscription) {
+    if (!hasClientSubscription(handle_info, sid)) {
         if (eventKey == 0) {
             /* wait until we've finished processing a subscription  */
             /*   (if we are in the middle) */
             /* this is to avoid mistakenly rejecting the first event if we  */
             /*   receive it before the subscription response */
-            globalHndLock.unlock();
+            globalHndLock.unlock_shared();
+
+            /* or wait for the asynchronous subscriptions in progress */
+            waitPendingSubscribes(sid);
 
             /* try and get Subscription Lock  */
             /*   (in case we are in the process of subscribing) */
             SubscribeLock();
 
             /* get HandleLock again */
-            globalHndLock.lock();
+            globalHndLock.lock_shared();
 
             if (GetClientHandleInfo(&client_handle,&handle_info) != HND_CLIENT) {
                 http_SendStatusResponse(mhdt, HTTP_PRECONDITION_FAILED);
                 SubscribeUnlock();
-                globalHndLock.unlock();
+                globalHndLock.unlock_shared();
                 return;
             }
 
-            subscription = std::find_if(
-                handle_info->ClientSubList.begin(), handle_info->ClientSubList.end(),
-                [sid](const ClientSubscription& e){return e.SID == sid;});
-            if (handle_info->ClientSubList.end() == subscription) {
+            if (!hasClientSubscription(handle_info, sid)) {
                 http_SendStatusResponse(mhdt, HTTP_PRECONDITION_FAILED);
                 SubscribeUnlock();
-                globalHndLock.unlock();
+                globalHndLock.unlock_shared();
                 return;
             }
 
@@ -742,7 +1331,7 @@ void gena_process_notification_event(MHDTransaction *mhdt)
                        "but event key not 0 (%d)\n", eventKey);
 
             http_SendStatusResponse(mhdt, HTTP_PRECONDITION_FAILED);
-            globalHndLock.unlock();
+            globalHndLock.unlock_shared();
             return;
         }
     }
@@ -750,23 +1339,118 @@ void gena_process_notification_event(MHDTransaction *mhdt)
     /* success */
     http_SendStatusResponse(mhdt, HTTP_OK);
 
-    /* fill event struct */
-    struct Upnp_Event event_struct;
-    event_struct.Sid = subscription->SID;
-    event_struct.EventKey = eventKey;
-    event_struct.ChangedVariables = propset;
-
     /* copy callback */
     auto callback = handle_info->Callback;
     auto cookie = handle_info->Cookie;
+    bool useviews = handle_info->EventViews;
 
-    globalHndLock.unlock();
+    globalHndLock.unlock_shared();
 
     /* make callback with event struct */
     /* In future, should find a way of mainting */
     /* that the handle is not unregistered in the middle of a */
     /* callback */
-    callback(UPNP_EVENT_RECEIVED, &event_struct, cookie);
+    if (useviews) {
+        /* The views point into the request buffer (or the parser
+           output), which stay valid until we return */
+        struct Upnp_Event_View event_view;
+        event_view.Sid = sid;
+        event_view.EventKey = eventKey;
+        if (inplace) {
+            event_view.ChangedVariables = std::move(views);
+        } else {
+            event_view.ChangedVariables.assign(propset.begin(), propset.end());
+        }
+        callback(UPNP_EVENT_RECEIVED_VIEW, &event_view, cookie);
+    } else {
+        struct Upnp_Event event_struct;
+        event_struct.Sid = sid;
+        event_struct.EventKey = eventKey;
+        if (inplace) {
+            for (const auto& [name, value] : views) {
+                event_struct.ChangedVariables.insert_or_assign(std::string(name), std::string(value));
+            }
+        } else {
+            event_struct.ChangedVariables = std::move(propset);
+        }
+        callback(UPNP_EVENT_RECEIVED, &event_struct, cookie);
+    }
+}
+
+void gena_process_multicast_event(
+    const char *packet, size_t len, const struct sockaddr_storage *from)
+{
+    std::string_view data(packet, len);
+    auto hdrend = data.find("\r\n\r\n");
+    if (data.compare(0, 14, "NOTIFY * HTTP/") != 0 || hdrend == std::string_view::npos) {
+        UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__,
+                   "gena_process_multicast_event: bad request line or headers\n");
+        return;
+    }
+    std::map<std::string, std::string> headers;
+    auto pos = data.find("\r\n") + 2;
+    while (pos < hdrend) {
+        auto eol = data.find("\r\n", pos);
+        auto line = data.substr(pos, eol - pos);
+        pos = eol + 2;
+        auto colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            continue;
+        }
+        std::string name(line.substr(0, colon));
+        std::string value(line.substr(colon + 1));
+        stringtolower(name);
+        trimstring(value, " \t");
+        headers[name] = value;
+    }
+    std::string_view body = data.substr(hdrend + 4);
+    auto itlen = headers.find("content-length");
+    if (itlen != headers.end()) {
+        auto clen = static_cast<size_t>(atoll(itlen->second.c_str()));
+        if (clen > body.size()) {
+            UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__,
+                       "gena_process_multicast_event: truncated datagram\n");
+            return;
+        }
+        body = body.substr(0, clen);
+    }
+
+    Upnp_Multicast_Event event;
+    char cb[2];
+    if (headers["nt"] != "upnp:event" || headers["nts"] != "upnp:propchange" ||
+        headers["usn"].empty() || headers["svcid"].empty() ||
+        sscanf(headers["seq"].c_str(), "%d%1c", &event.EventKey, cb) != 1) {
+        UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__,
+                   "gena_process_multicast_event: missing or bad header\n");
+        return;
+    }
+    event.USN = headers["usn"];
+    event.ServiceId = headers["svcid"];
+    event.Level = headers["lvl"];
+    event.BootId = atoi(headers["bootid.upnp.org"].c_str());
+    event.DestAddr = *from;
+    std::string xml(body);
+    UPnPPropertysetParser parser(xml, event.ChangedVariables);
+    if (!parser.Parse()) {
+        UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__,
+                   "gena_process_multicast_event: xml parse failed\n");
+        return;
+    }
+
+    Upnp_FunPtr callback;
+    void *cookie;
+    {
+        HANDLELOCK_SHARED();
+        struct Handle_Info *handle_info;
+        UpnpClient_Handle client_handle;
+        if (GetClientHandleInfo(&client_handle, &handle_info) != HND_CLIENT ||
+            !handle_info->MulticastEvents) {
+            return;
+        }
+        callback = handle_info->Callback;
+        cookie = handle_info->Cookie;
+    }
+    callback(UPNP_EVENT_MULTICAST_RECEIVED, &event, cookie);
 }
 
 
@@ -36,20 +36,58 @@
 #if EXCLUDE_GENA == 0
 #ifdef INCLUDE_DEVICE_APIS
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <curl/curl.h>
 
 #include "gena.h"
 #include "gena_sids.h"
 #include "genut.h"
+#include "smallut.h"
+#include "ssdplib.h"
 #include "statcodes.h"
 #include "upnpapi.h"
 #include "uri.h"
+#include "xmlbuild.h"
 
-static constexpr auto XML_PROPERTYSET_HEADER =
+static constexpr std::string_view XML_PROPERTYSET_HEADER =
     R"(<e:propertyset xmlns:e="urn:schemas-upnp-org:event-1-0">)" "\n";
+static constexpr std::string_view XML_PROPERTYSET_END = "</e:propertyset>\n\n";
+static constexpr std::string_view XML_PROPERTY_START = "<e:property>\n";
+static constexpr std::string_view XML_PROPERTY_END = "\n</e:property>\n";
+
+using PropertyVars = std::vector<std::pair<std::string, std::string>>;
+
+/* Build a property set from names and values. The values are used as
+   is: they are escaped by the application. */
+template <class T> static std::string propertySetFromVars(const T& vars)
+{
+    xmlbuild::XMLBuilder out(
+        XML_PROPERTYSET_HEADER.size() + XML_PROPERTYSET_END.size() +
+        xmlbuild::elementsSize(vars) +
+        vars.size() * (XML_PROPERTY_START.size() + XML_PROPERTY_END.size()));
+    out.append(XML_PROPERTYSET_HEADER);
+    for (const auto& [name, value] : vars) {
+        out.append(XML_PROPERTY_START).element(name, value, false).append(XML_PROPERTY_END);
+    }
+    out.append(XML_PROPERTYSET_END);
+    return out.take();
+}
+
+static void saveSubscriptions(const struct Handle_Info *handle_info);
 
 /*!
  * \brief Unregisters a device.
@@ -66,6 +104,9 @@ int genaUnregisterDevice(UpnpDevice_Handle device_handle)
             "genaUnregisterDevice: BAD Handle: %d\n", device_handle);
         return UPNP_E_INVALID_HANDLE;
     }
+    if (!g_subscriptionsFile.empty()) {
+        saveSubscriptions(handle_info);
+    }
     clearServiceTable(handle_info->serviceTable);
     return UPNP_E_SUCCESS;
 }
@@ -88,176 +129,876 @@ static int GeneratePropertySet(
     /*! [out] PropertySet node in the string format. */
     std::string *pout)
 {
-    std::string& out = *pout;
-    out = XML_PROPERTYSET_HEADER;
+    std::vector<std::pair<std::string_view, std::string_view>> vars;
+    vars.reserve(count);
     for (int counter = 0; counter < count; counter++) {
-        out += "<e:property>\n";
-        out += std::string("<") +names[counter] + ">"+values[counter]+ "</" +
-            names[counter] + ">\n</e:property>\n";
+        vars.emplace_back(names[counter], values[counter]);
     }
-    out += "</e:propertyset>\n\n";
+    *pout = propertySetFromVars(vars);
     return UPNP_E_SUCCESS;
 }
 
 
+/* Skip white space, return false if at end */
+static bool skipws(const std::string& s, std::string::size_type& pos)
+{
+    while (pos < s.size() && isspace(static_cast<unsigned char>(s[pos])))
+        pos++;
+    return pos < s.size();
+}
+
+/* Read a simple tag (no attributes except on the propertyset element)
+   at pos. Returns the tag name, including a leading '/' for a closing
+   tag, with the namespace prefix stripped. */
+static bool readTag(const std::string& s, std::string::size_type& pos, std::string& name,
+                    bool allowattrs = false)
+{
+    if (!skipws(s, pos) || s[pos] != '<')
+        return false;
+    auto end = s.find('>', pos);
+    if (end == std::string::npos)
+        return false;
+    name = s.substr(pos + 1, end - pos - 1);
+    pos = end + 1;
+    auto sp = name.find_first_of(" \t\r\n");
+    if (sp != std::string::npos) {
+        if (!allowattrs)
+            return false;
+        name.erase(sp);
+    }
+    bool closing = !name.empty() && name[0] == '/';
+    auto colon = name.find(':');
+    if (colon != std::string::npos) {
+        name = (closing ? "/" : "") + name.substr(colon + 1);
+    }
+    return !name.empty();
+}
+
 /*!
- * \brief Function to Notify a particular subscription of a particular event.
+ * \brief Extract the variables from a property set document.
  *
- * This is called by a thread pool thread, and the subscription is a
- * copy of the handle table data, so, no locking.
- *
- * NOTIFY http request is sent and the reply is processed.
+ * This only accepts the simple layout which we and the usual
+ * applications generate: one variable per property element, with a
+ * text value (escaped, not CDATA). The values are kept in their raw
+ * (escaped) form. Returns false for anything else, in which case the
+ * event is never merged.
+ */
+static bool parsePropertySet(const std::string& xml, PropertyVars& vars)
+{
+    std::string::size_type pos = 0;
+    std::string tag;
+    if (skipws(xml, pos) && xml.compare(pos, 5, "<?xml") == 0) {
+        pos = xml.find("?>", pos);
+        if (pos == std::string::npos)
+            return false;
+        pos += 2;
+    }
+    if (!readTag(xml, pos, tag, true) || tag != "propertyset")
+        return false;
+    for (;;) {
+        if (!readTag(xml, pos, tag))
+            return false;
+        if (tag == "/propertyset")
+            break;
+        if (tag != "property")
+            return false;
+        std::string name;
+        if (!readTag(xml, pos, name) || name[0] == '/')
+            return false;
+        auto end = xml.find('<', pos);
+        if (end == std::string::npos)
+            return false;
+        std::string value = xml.substr(pos, end - pos);
+        pos = end;
+        if (!readTag(xml, pos, tag) || tag != "/" + name)
+            return false;
+        if (!readTag(xml, pos, tag) || tag != "/property")
+            return false;
+        vars.emplace_back(name, std::move(value));
+    }
+    return true;
+}
+
+
+/* The data for one event, shared by the notifications to all the
+   subscribers: a LastChange document can be big, and there may be
+   many subscribed CPs. The NOTIFY requests are sent directly from
+   the propertySet buffer. The contents are immutable, except for the
+   variables cache, which is only accessed with the handle lock held. */
+struct GenaEvent {
+    GenaEvent(std::string servid, std::string udn, std::string pset)
+        : UDN(std::move(udn)), servId(std::move(servid)), propertySet(std::move(pset)) {}
+    const std::string UDN;                 // Device
+    const std::string servId;  // Service
+    const std::string propertySet; // Message content
+    /* Variables, extracted from propertySet when needed for merging */
+    enum VarsState {VARS_UNKNOWN, VARS_OK, VARS_BAD};
+    mutable VarsState varsState{VARS_UNKNOWN};
+    mutable PropertyVars vars;
+};
+
+/* Notification structures are queued on the output queue of every
+   subscription. */
+struct Notification {
+    Notification(std::shared_ptr<const GenaEvent> ev, Upnp_SID uSID, time_t ct,
+                 UpnpDevice_Handle dh)
+        : device_handle(dh), event(std::move(ev)), sid(std::move(uSID)), ctime(ct) {}
+    UpnpDevice_Handle device_handle; //
+    std::shared_ptr<const GenaEvent> event;
+    Upnp_SID sid;        // Subscription
+    time_t ctime;        // Age
+    std::chrono::steady_clock::time_point sendtime; // For the delivery latency
+};
+
+/* The subscription data needed for sending the events. It is created
+   with the subscription and never modified, so that the transfers can
+   share it without copying and the engine does not need the handle
+   lock. Only the event key (SEQ header) changes for each event. */
+struct DeliveryTarget {
+    DeliveryTarget(const Upnp_SID& sid, std::vector<std::string> _urls)
+        : urls(std::move(_urls)) {
+        struct curl_slist *list = nullptr;
+        list = curl_slist_append(list, "NT: upnp:event");
+        list = curl_slist_append(list, "NTS: upnp:propchange");
+        list = curl_slist_append(list, (std::string("SID: ") + sid).c_str());
+        list = curl_slist_append(list, "Accept:");
+        list = curl_slist_append(list, "Expect:");
+        list = curl_slist_append(list, R"(Content-Type: text/xml; charset="utf-8")");
+        headers = list;
+    }
+    ~DeliveryTarget() {
+        if (headers)
+            curl_slist_free_all(headers);
+    }
+    DeliveryTarget(const DeliveryTarget&) = delete;
+    DeliveryTarget& operator=(const DeliveryTarget&) = delete;
+
+    /* We try the delivery URLs in order until one goes through */
+    const std::vector<std::string> urls;
+    /* Constant headers. Read-only after construction. */
+    struct curl_slist *headers{nullptr};
+};
+
+/* One NOTIFY request in the sending engine. */
+struct NotifyTransfer {
+    NotifyTransfer() = default;
+    ~NotifyTransfer() {
+        if (headers) {
+            // Only free our SEQ node, the rest belongs to the target
+            headers->next = nullptr;
+            curl_slist_free_all(headers);
+        }
+    }
+    NotifyTransfer(const NotifyTransfer&) = delete;
+    NotifyTransfer& operator=(const NotifyTransfer&) = delete;
+
+    std::shared_ptr<Notification> notif;
+    std::shared_ptr<const DeliveryTarget> target;
+    size_t urlidx{0};
+    /* The SEQ header, linked in front of the target constant headers */
+    struct curl_slist *headers{nullptr};
+    char curlerrormessage[CURL_ERROR_SIZE];
+    /* Called from the engine thread when done, with the status. */
+    std::function<void(const std::shared_ptr<Notification>&, int)> done;
+};
+
+/*!
+ * \brief Sends the GENA notifications.
  *
- * \return UPNP_E_SUCCESS if the event was delivered, otherwise returns the
- *     appropriate error code.
+ * A single thread drives all the outstanding NOTIFY requests with a
+ * curl multi handle, so that slow or unreachable Control Points do not
+ * block threads. The multi handle keeps the connections open for
+ * reuse by the next events to the same subscriber. Transfer handles
+ * are recycled.
  *
- * The only code which has specific processing is
- * GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB which results in clearing the
- * subscription. This can only happen if the HTTP transaction is
- * network-successful but has an HTTP status of 412, which results in
- * clearing the subscription (else, subscriptions are only removed
- * when they time-out).
- * The previous version had more detailed error codes, but all other
- * error codes were just ignored, except for message printing.
+ * The completion callbacks are called from the engine thread, without
+ * any engine lock held, so that they can take the handle lock and
+ * submit the next event.
  */
-static int genaNotify(const std::string& propertySet, const subscription *sub)
+class GenaNotifyEngine {
+public:
+    int start();
+    void stop();
+    int submit(std::unique_ptr<NotifyTransfer> transfer);
+    int submit(std::vector<std::unique_ptr<NotifyTransfer>>& transfers);
+
+private:
+    void run();
+    bool startTransfer(std::unique_ptr<NotifyTransfer> transfer, CURL *easy = nullptr);
+    void transferDone(CURL *easy, CURLcode code);
+    void releaseEasy(CURL *easy);
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    /* Protected by m_mutex */
+    CURLM *m_multi{nullptr};
+    bool m_stop{false};
+    std::vector<std::unique_ptr<NotifyTransfer>> m_queue;
+    /* Only accessed from the engine thread */
+    std::unordered_map<CURL*, std::unique_ptr<NotifyTransfer>> m_active;
+    std::vector<CURL*> m_spare;
+};
+
+static GenaNotifyEngine notifyEngine;
+
+int GenaNotifyEngine::start()
 {
-    int return_code = -1;
-    long http_code = 0;
+    std::scoped_lock lck(m_mutex);
+    if (m_multi) {
+        return UPNP_E_SUCCESS;
+    }
+    m_multi = curl_multi_init();
+    if (nullptr == m_multi) {
+        return UPNP_E_INIT_FAILED;
+    }
+    curl_multi_setopt(m_multi, CURLMOPT_MAXCONNECTS, long(GENA_NOTIFY_CONNECTION_CACHE_SIZE));
+    m_stop = false;
+    m_thread = std::thread(&GenaNotifyEngine::run, this);
+    return UPNP_E_SUCCESS;
+}
+
+void GenaNotifyEngine::stop()
+{
+    {
+        std::scoped_lock lck(m_mutex);
+        if (nullptr == m_multi) {
+            return;
+        }
+        m_stop = true;
+#if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_wakeup(m_multi);
+#endif
+    }
+    m_thread.join();
+    std::scoped_lock lck(m_mutex);
+    // Pending and active transfers are discarded: the devices are gone.
+    m_queue.clear();
+    for (auto& [easy, transfer] : m_active) {
+        curl_multi_remove_handle(m_multi, easy);
+        curl_easy_cleanup(easy);
+    }
+    m_active.clear();
+    for (auto easy : m_spare) {
+        curl_easy_cleanup(easy);
+    }
+    m_spare.clear();
+    curl_multi_cleanup(m_multi);
+    m_multi = nullptr;
+}
+
+int GenaNotifyEngine::submit(std::unique_ptr<NotifyTransfer> transfer)
+{
+    std::scoped_lock lck(m_mutex);
+    if (nullptr == m_multi || m_stop) {
+        return UPNP_E_FINISH;
+    }
+    m_queue.push_back(std::move(transfer));
+#if LIBCURL_VERSION_NUM >= 0x074400
+    curl_multi_wakeup(m_multi);
+#endif
+    return UPNP_E_SUCCESS;
+}
 
-    /* send a notify to each url until one goes thru */
-    for (const auto& url : sub->DeliveryURLs) {
-        CURL *easy = curl_easy_init();
-        char curlerrormessage[CURL_ERROR_SIZE];
+int GenaNotifyEngine::submit(std::vector<std::unique_ptr<NotifyTransfer>>& transfers)
+{
+    std::scoped_lock lck(m_mutex);
+    if (nullptr == m_multi || m_stop) {
+        return UPNP_E_FINISH;
+    }
+    for (auto& transfer : transfers) {
+        m_queue.push_back(std::move(transfer));
+    }
+    transfers.clear();
+#if LIBCURL_VERSION_NUM >= 0x074400
+    curl_multi_wakeup(m_multi);
+#endif
+    return UPNP_E_SUCCESS;
+}
 
-        curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, curlerrormessage);
+bool GenaNotifyEngine::startTransfer(std::unique_ptr<NotifyTransfer> transfer, CURL *easy)
+{
+    if (nullptr == easy) {
+        if (!m_spare.empty()) {
+            easy = m_spare.back();
+            m_spare.pop_back();
+        } else {
+            easy = curl_easy_init();
+            if (nullptr == easy) {
+                return false;
+            }
+        }
+        const auto& propertySet = transfer->notif->event->propertySet;
+        curl_easy_setopt(easy, CURLOPT_NOSIGNAL, long(1));
+        curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, transfer->curlerrormessage);
         curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, write_callback_null_curl);
         curl_easy_setopt(easy, CURLOPT_WRITEDATA, nullptr);
         curl_easy_setopt(easy, CURLOPT_TIMEOUT,
                          long(GENA_NOTIFICATION_SENDING_TIMEOUT +
                               GENA_NOTIFICATION_ANSWERING_TIMEOUT)/2);
         curl_easy_setopt(easy, CURLOPT_POST, long(1));
+        // Not copied by curl: the transfer holds a reference to the event data.
         curl_easy_setopt(easy, CURLOPT_POSTFIELDS, propertySet.c_str());
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE, long(propertySet.size()));
         curl_easy_setopt(easy, CURLOPT_CUSTOMREQUEST, "NOTIFY");
+        curl_easy_setopt(easy, CURLOPT_HTTPHEADER, transfer->headers);
+    }
+    transfer->curlerrormessage[0] = 0;
+    curl_easy_setopt(easy, CURLOPT_URL, transfer->target->urls[transfer->urlidx].c_str());
+    if (curl_multi_add_handle(m_multi, easy) != CURLM_OK) {
+        releaseEasy(easy);
+        return false;
+    }
+    m_active[easy] = std::move(transfer);
+    return true;
+}
 
-        struct curl_slist *list = nullptr;
-        list = curl_slist_append(list, "NT: upnp:event");
-        list = curl_slist_append(list, "NTS: upnp:propchange");
-        list = curl_slist_append(list,(std::string("SID: ") + sub->sid).c_str());
-        auto buff = std::to_string(sub->ToSendEventKey);
-        list = curl_slist_append(list, (std::string("SEQ: ") + buff).c_str());
-
-        list = curl_slist_append(list, "Accept:");
-        list = curl_slist_append(list, "Expect:");
-        list = curl_slist_append(list, R"(Content-Type: text/xml; charset="utf-8")");
-        curl_easy_setopt(easy, CURLOPT_HTTPHEADER, list);
-        curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
-
-        CURLcode code = curl_easy_perform(easy);
-        if (code == CURLE_OK) {
-            return_code = UPNP_E_SUCCESS;
-            curl_easy_getinfo (easy, CURLINFO_RESPONSE_CODE, &http_code);
-        } else {
-            // Note: this is common: e.g. client exited without unsubscribing
-            UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__,
-                       "CURL ERROR MESSAGE %s\n", curlerrormessage);
-            return_code = UPNP_E_BAD_RESPONSE;
-        }
-        /* Clean-up. */
-        curl_slist_free_all(list);
+void GenaNotifyEngine::releaseEasy(CURL *easy)
+{
+    if (m_spare.size() < GENA_NOTIFY_CONNECTION_CACHE_SIZE) {
+        curl_easy_reset(easy);
+        m_spare.push_back(easy);
+    } else {
         curl_easy_cleanup(easy);
+    }
+}
 
-        if (return_code == UPNP_E_SUCCESS)
-            break;
+/*!
+ * \brief Process the result of a NOTIFY transfer.
+ *
+ * The only code which has specific processing is
+ * GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB which results in clearing the
+ * subscription. This can only happen if the HTTP transaction is
+ * network-successful but has an HTTP status of 412, which results in
+ * clearing the subscription (else, subscriptions are only removed
+ * when they time-out).
+ * The previous version had more detailed error codes, but all other
+ * error codes were just ignored, except for message printing.
+ */
+void GenaNotifyEngine::transferDone(CURL *easy, CURLcode code)
+{
+    auto it = m_active.find(easy);
+    if (it == m_active.end()) {
+        return;
     }
+    auto transfer = std::move(it->second);
+    m_active.erase(it);
+    curl_multi_remove_handle(m_multi, easy);
 
-    if (return_code == UPNP_E_SUCCESS) {
+    int return_code;
+    if (code == CURLE_OK) {
+        long http_code = 0;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &http_code);
         if (http_code == HTTP_OK) {
             return_code = UPNP_E_SUCCESS;
+        } else if (http_code == HTTP_PRECONDITION_FAILED) {
+            /*Invalid SID gets removed */
+            return_code = GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB;
         } else {
-            if (http_code == HTTP_PRECONDITION_FAILED)
-                /*Invalid SID gets removed */
-                return_code = GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB;
-            else
-                return_code = UPNP_E_NOTIFY_UNACCEPTED;
+            return_code = UPNP_E_NOTIFY_UNACCEPTED;
+        }
+    } else {
+        // Note: this is common: e.g. client exited without unsubscribing
+        UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__,
+                   "CURL ERROR MESSAGE %s\n", transfer->curlerrormessage);
+        if (++transfer->urlidx < transfer->target->urls.size()) {
+            // Try the next delivery URL
+            auto done = transfer->done;
+            auto notif = transfer->notif;
+            if (!startTransfer(std::move(transfer), easy) && done) {
+                done(notif, UPNP_E_BAD_RESPONSE);
+            }
+            return;
+        }
+        return_code = UPNP_E_BAD_RESPONSE;
+    }
+    releaseEasy(easy);
+    if (transfer->done) {
+        transfer->done(transfer->notif, return_code);
+    }
+}
+
+void GenaNotifyEngine::run()
+{
+    std::vector<std::unique_ptr<NotifyTransfer>> incoming;
+    for (;;) {
+        {
+            std::scoped_lock lck(m_mutex);
+            if (m_stop) {
+                break;
+            }
+            incoming.swap(m_queue);
+        }
+        for (auto& transfer : incoming) {
+            auto done = transfer->done;
+            auto notif = transfer->notif;
+            if (!startTransfer(std::move(transfer)) && done) {
+                done(notif, UPNP_E_OUTOF_MEMORY);
+            }
+        }
+        incoming.clear();
+
+        int running;
+        curl_multi_perform(m_multi, &running);
+        CURLMsg *msg;
+        int msgsleft;
+        while ((msg = curl_multi_info_read(m_multi, &msgsleft))) {
+            if (msg->msg == CURLMSG_DONE) {
+                transferDone(msg->easy_handle, msg->data.result);
+            }
         }
+
+#if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_poll(m_multi, nullptr, 0, 1000, nullptr);
+#else
+        // No wakeup call in this curl version: poll the submission queue.
+        curl_multi_wait(m_multi, nullptr, 0, 50, nullptr);
+#endif
     }
-    return return_code;
 }
 
+/* Subscription expiry. A single timer is set for the earliest
+   expiration time over all the device services, so that expired
+   subscriptions are removed on time instead of when the lists are
+   next walked. The state is protected by the handle lock. */
+static time_t expiryTimerTime; /* Time the timer is set for, 0 if none */
+static uint64_t expiryTimerRuns;
 
-/* Notification structures are queued on the output queue of every
-   subscription.  They hold some common data because the same event is
-   sent to all subscribed CPs. Probably not worth the trouble sharing
-   though (e.g. with shared_ptr for the propertySet string. We don't
-   typically have thousands of subscribed CPs... */
-struct Notification {
-    Notification(std::string sid, std::string udn, std::string pset, Upnp_SID uSID,
-                 time_t ct, UpnpDevice_Handle dh)
-        : device_handle(dh), UDN(std::move(udn)), servId(std::move(sid)), sid(std::move(uSID)),
-          propertySet(std::move(pset)), ctime(ct) {}
-    UpnpDevice_Handle device_handle; //
-    std::string UDN;                 // Device
-    std::string servId;  // Service
-    Upnp_SID sid;        // Subscription
-    std::string propertySet; // Message content
-    time_t ctime;        // Age
-};
+static void scheduleExpiry(time_t expireTime);
 
-class GenaNotifyJobWorker : public JobWorker {
+class SubscriptionExpiryJobWorker : public JobWorker {
 public:
-    explicit GenaNotifyJobWorker(std::shared_ptr<Notification> in)
-        : m_input(std::move(in)) {}
+    explicit SubscriptionExpiryJobWorker(time_t when) : m_when(when) {}
     void work() override;
-    // This is actually shared with the outgoing list head.  Note: 2024-02: as far as I understand,
-    // the only reason to keep a shared pointer to the active notification at the head of the
-    // subscription outgoing queue is as an indicator that we don't need to kickstart the
-    // queue. Else when adding an event and seeing an empty queue, we would not know if the event
-    // should be queued or directly sent to the Thread Pool. This could probably be replaced by a
-    // flag, which would allow to replace the shared_ptr with unique_ptr.
-    std::shared_ptr<Notification> m_input;
+private:
+    time_t m_when;
 };
 
-/*!
- * \brief Thread job to Notify a control point.
- *
- * It validates and copies the subscription so that the lock can be
- * released during the actual network transfer (done by genaNotify())
- */
-void GenaNotifyJobWorker::work()
+void SubscriptionExpiryJobWorker::work()
+{
+    HANDLELOCK();
+    expiryTimerRuns++;
+    // A timer superseded by an earlier one is not the current timer
+    // any more. It still does the expiry, which is harmless.
+    if (expiryTimerTime == m_when) {
+        expiryTimerTime = 0;
+    }
+    time_t now = time(nullptr);
+    time_t next = 0;
+    UpnpDevice_Handle hnd = 0;
+    struct Handle_Info *handle_info;
+    while (GetDeviceHandleInfo(hnd, &hnd, &handle_info) == HND_DEVICE) {
+        for (auto& service : handle_info->serviceTable) {
+            service.expiredByTimer += ExpireSubscriptions(&service, now);
+            if (!service.subscriptionsByExpiry.empty()) {
+                time_t first = service.subscriptionsByExpiry.begin()->first;
+                if (next == 0 || first < next) {
+                    next = first;
+                }
+            }
+        }
+    }
+    if (next != 0) {
+        scheduleExpiry(next);
+    }
+}
+
+/* Make sure that the expiry timer will run after expireTime. Called
+   with the handle lock held when a subscription is added or renewed. */
+static void scheduleExpiry(time_t expireTime)
+{
+    if (expireTime == 0) {
+        return;
+    }
+    // A subscription expires after its expireTime
+    time_t when = expireTime + 1;
+    if (expiryTimerTime != 0 && expiryTimerTime <= when) {
+        return;
+    }
+    auto worker = std::make_unique<SubscriptionExpiryJobWorker>(when);
+    if (gTimerThread->schedule(TimerThread::SHORT_TERM, TimerThread::ABS_SEC, when,
+                               nullptr, std::move(worker)) == UPNP_E_SUCCESS) {
+        expiryTimerTime = when;
+    }
+}
+
+int genaGetSubscriptionStats(UpnpDevice_Handle device_handle, UpnpSubscriptionStats& stats)
 {
-    subscription *sub;
-    service_info *service;
-    subscription sub_copy;
-    int return_code;
     struct Handle_Info *handle_info;
 
+    HANDLELOCK_SHARED();
+    if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    stats = UpnpSubscriptionStats();
+    for (const auto& service : handle_info->serviceTable) {
+        stats.subscriptions += service.TotalSubscriptions;
+        stats.timed += static_cast<int>(service.subscriptionsByExpiry.size());
+        if (!service.subscriptionsByExpiry.empty()) {
+            time_t first = service.subscriptionsByExpiry.begin()->first;
+            if (stats.nextExpiry == 0 || first < stats.nextExpiry) {
+                stats.nextExpiry = first;
+            }
+        }
+        stats.expiredByTimer += service.expiredByTimer;
+        stats.expiredOnAccess += service.expiredOnAccess;
+    }
+    stats.expiryTimerTime = expiryTimerTime;
+    stats.expiryTimerRuns = expiryTimerRuns;
+    return UPNP_E_SUCCESS;
+}
+
+/* Persisted subscriptions. When the library is initialized with
+   UPNP_OPTION_SUBSCRIPTIONS_FILE, the subscriptions of a root device
+   are saved when it is unregistered, and restored when a device with
+   the same UDN is registered again with the same CONFIGID, so that the
+   control points keep receiving events after a restart. The file is
+   text, one section per root device:
+     npupnp-subscriptions 1
+     device <root UDN> <configid>
+     sub <service UDN> <serviceId> <SID> <expiry time> <event key> <URL> [<URL>...]
+   with tab-separated fields. Expired subscriptions are not restored. */
+static const std::string subsFileHeader{"npupnp-subscriptions\t1"};
+
+/* Read the sections of the file, except the one for udn, which is
+   being replaced */
+static std::vector<std::string> otherSections(const std::string& udn)
+{
+    std::vector<std::string> lines;
+    std::ifstream input(g_subscriptionsFile);
+    std::string line;
+    if (!std::getline(input, line) || line != subsFileHeader) {
+        return lines;
+    }
+    bool skip = false;
+    while (std::getline(input, line)) {
+        if (beginswith(line, "device\t")) {
+            std::vector<std::string> tokens;
+            stringToTokens(line, tokens, "\t");
+            skip = tokens.size() >= 2 && tokens[1] == udn;
+        }
+        if (!skip) {
+            lines.push_back(line);
+        }
+    }
+    return lines;
+}
+
+/* Called with the handle lock held, from genaUnregisterDevice */
+static void saveSubscriptions(const struct Handle_Info *handle_info)
+{
+    const std::string& udn = handle_info->devdesc.UDN;
+    auto lines = otherSections(udn);
+    lines.push_back("device\t" + udn + "\t" + std::to_string(g_configidUpnpOrg));
+    int count = 0;
+    time_t now = time(nullptr);
+    for (const auto& service : handle_info->serviceTable) {
+        for (const auto& sub : service.subscriptionList) {
+            if (!sub.active || (sub.expireTime != 0 && sub.expireTime < now) ||
+                !sub.delivery || sub.delivery->urls.empty()) {
+                continue;
+            }
+            std::string line = "sub\t" + service.UDN + "\t" + service.serviceId + "\t" +
+                sub.sid + "\t" + std::to_string(sub.expireTime) + "\t" +
+                std::to_string(sub.ToSendEventKey) + "\t";
+            for (const auto& url : sub.delivery->urls) {
+                line += url + " ";
+            }
+            line.pop_back();
+            lines.push_back(std::move(line));
+            count++;
+        }
+    }
+
+    // Write a temporary file and rename it, so that a crash does not
+    // leave a truncated file.
+    std::string tmpname = g_subscriptionsFile + ".tmp";
     {
-        HANDLELOCK();
-        /* validate context */
-        if (GetHandleInfo(m_input->device_handle, &handle_info) != HND_DEVICE) {
+        std::ofstream output(tmpname, std::ios::trunc);
+        output << subsFileHeader << "\n";
+        for (const auto& line : lines) {
+            output << line << "\n";
+        }
+        output.close();
+        if (!output) {
+            UpnpPrintf(UPNP_ERROR, GENA, __FILE__, __LINE__,
+                       "saveSubscriptions: could not write %s\n", tmpname.c_str());
             return;
         }
+    }
+    if (std::rename(tmpname.c_str(), g_subscriptionsFile.c_str()) != 0) {
+        UpnpPrintf(UPNP_ERROR, GENA, __FILE__, __LINE__,
+                   "saveSubscriptions: could not rename %s\n", tmpname.c_str());
+        return;
+    }
+    UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
+               "saveSubscriptions: saved %d subscriptions for %s\n", count, udn.c_str());
+}
+
+int genaRestoreSubscriptions(struct Handle_Info *handle_info)
+{
+    if (g_subscriptionsFile.empty()) {
+        return 0;
+    }
+    std::ifstream input(g_subscriptionsFile);
+    std::string line;
+    if (!std::getline(input, line) || line != subsFileHeader) {
+        return 0;
+    }
+    const std::string& udn = handle_info->devdesc.UDN;
+    time_t now = time(nullptr);
+    bool insection = false;
+    int count = 0;
+    while (std::getline(input, line)) {
+        std::vector<std::string> tokens;
+        stringToTokens(line, tokens, "\t");
+        if (tokens.empty()) {
+            continue;
+        }
+        if (tokens[0] == "device") {
+            // Restore only for the same device and configuration
+            insection = tokens.size() == 3 && tokens[1] == udn &&
+                atoi(tokens[2].c_str()) == g_configidUpnpOrg;
+            continue;
+        }
+        if (!insection || tokens[0] != "sub" || tokens.size() != 7) {
+            continue;
+        }
+        time_t expireTime = static_cast<time_t>(atoll(tokens[4].c_str()));
+        if (expireTime != 0 && expireTime < now) {
+            continue;
+        }
+        service_info *service =
+            FindServiceId(handle_info->serviceTable, tokens[2], tokens[1]);
+        if (nullptr == service || GetSubscriptionSID(tokens[3], service)) {
+            continue;
+        }
+        std::vector<std::string> urls;
+        stringToTokens(tokens[6], urls, " ");
+        if (urls.empty()) {
+            continue;
+        }
+        subscription sub;
+        sub.sid = tokens[3];
+        sub.expireTime = expireTime;
+        sub.ToSendEventKey = atoi(tokens[5].c_str());
+        sub.active = 1;
+        sub.delivery = std::make_shared<DeliveryTarget>(sub.sid, std::move(urls));
+        if (AddSubscription(service, std::move(sub)) == service->subscriptionList.end()) {
+            continue;
+        }
+        scheduleExpiry(expireTime);
+        count++;
+    }
+    if (count) {
+        UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
+                   "genaRestoreSubscriptions: restored %d subscriptions for %s\n",
+                   count, udn.c_str());
+    }
+    return count;
+}
+
+int genaNotifyEngineStart()
+{
+    return notifyEngine.start();
+}
+
+void genaNotifyEngineStop()
+{
+    notifyEngine.stop();
+    // The timer thread is about to go away with its pending events
+    HANDLELOCK();
+    expiryTimerTime = 0;
+}
+
+static void genaNotifyDone(const std::shared_ptr<Notification>& notif, int return_code);
+
+/* Create the transfer for the event at the head of a subscription
+   queue. Called with the handle lock held. */
+static std::unique_ptr<NotifyTransfer> makeNotifyTransfer(
+    std::shared_ptr<Notification> notif, const subscription *sub)
+{
+    if (!sub->delivery || sub->delivery->urls.empty()) {
+        return {};
+    }
+    auto transfer = std::make_unique<NotifyTransfer>();
+    transfer->target = sub->delivery;
+    auto seq = std::string("SEQ: ") + std::to_string(sub->ToSendEventKey);
+    transfer->headers = curl_slist_append(nullptr, seq.c_str());
+    if (nullptr == transfer->headers) {
+        return {};
+    }
+    transfer->headers->next = transfer->target->headers;
+    notif->sendtime = std::chrono::steady_clock::now();
+    transfer->notif = std::move(notif);
+    transfer->done = genaNotifyDone;
+    return transfer;
+}
+
+/*!
+ * \brief Start sending the event at the head of a subscription queue.
+ *
+ * Called with the handle lock held.
+ */
+static int genaStartNotify(std::shared_ptr<Notification> notif, const subscription *sub)
+{
+    auto transfer = makeNotifyTransfer(std::move(notif), sub);
+    if (!transfer) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    return notifyEngine.submit(std::move(transfer));
+}
+
+/* Transfers created while processing several events, submitted to the
+   engine together. */
+struct NotifyBatch {
+    std::vector<subscription*> subs;
+    std::vector<std::unique_ptr<NotifyTransfer>> transfers;
+};
+
+/* Called with the handle lock held */
+static int submitBatch(NotifyBatch& batch)
+{
+    if (batch.transfers.empty()) {
+        return UPNP_E_SUCCESS;
+    }
+    int ret = notifyEngine.submit(batch.transfers);
+    if (ret != UPNP_E_SUCCESS) {
+        // The queues were empty when the batch started, and the lock was
+        // held since, so everything in them was added by this batch
+        // (there may be pending events behind the head if a subscription
+        // got several). Nothing is in flight to restart them: drop all.
+        for (auto sub : batch.subs) {
+            while (!sub->outgoing.empty()) {
+                sub->outgoing.pop_front();
+            }
+            sub->outgoingBytes = 0;
+        }
+    }
+    batch.subs.clear();
+    batch.transfers.clear();
+    return ret;
+}
+
+static bool eventVars(const GenaEvent& event);
+static void mergeVars(PropertyVars& into, const PropertyVars& from);
+
+/* Restart the delivery for a suspended subscription */
+class NotifyResumeJobWorker : public JobWorker {
+public:
+    NotifyResumeJobWorker(UpnpDevice_Handle hnd, std::string servid, std::string udn,
+                          Upnp_SID sid)
+        : m_hnd(hnd), m_servid(std::move(servid)), m_udn(std::move(udn)),
+          m_sid(std::move(sid)) {}
+    void work() override;
+private:
+    UpnpDevice_Handle m_hnd;
+    std::string m_servid;
+    std::string m_udn;
+    Upnp_SID m_sid;
+};
+
+/* Suspend the delivery to a failing subscriber. Called with the handle
+   lock held. The failed event stays at the head of the queue. Returns
+   false if the resume timer could not be set (the delivery goes on). */
+static bool suspendDelivery(const Notification& notif, subscription *sub)
+{
+    int excess = std::min(sub->consecutiveFailures - GENA_NOTIFY_FAILURES_BEFORE_BACKOFF, 16);
+    auto delay = std::min(time_t(GENA_NOTIFY_BACKOFF_MIN) << excess,
+                          time_t(GENA_NOTIFY_BACKOFF_MAX));
+    UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
+               "Suspending event delivery to %s for %d S after %d failures\n",
+               sub->sid.c_str(), int(delay), sub->consecutiveFailures);
+    sub->suspendedUntil = time(nullptr) + delay;
+    auto worker = std::make_unique<NotifyResumeJobWorker>(
+        notif.device_handle, notif.event->servId, notif.event->UDN, sub->sid);
+    if (gTimerThread->schedule(TimerThread::SHORT_TERM, TimerThread::REL_SEC, delay,
+                               nullptr, std::move(worker)) != UPNP_E_SUCCESS) {
+        sub->suspendedUntil = 0;
+        return false;
+    }
+    return true;
+}
 
-        if (!(service = FindServiceId(handle_info->serviceTable, m_input->servId, m_input->UDN)) ||
-            !service->active ||
-            !(sub = GetSubscriptionSID(m_input->sid, service)) ||
-            copy_subscription(sub, &sub_copy) != UPNP_E_SUCCESS) {
+/* Merge all the queued events into one before retrying, so that a
+   subscriber which comes back only gets the latest state. If some
+   property set can't be parsed, the queue is left alone. */
+static void coalesceQueue(subscription *sub)
+{
+    auto& outgoing = sub->outgoing;
+    if (outgoing.size() < 2) {
+        return;
+    }
+    for (size_t i = 0; i < outgoing.size(); i++) {
+        if (!eventVars(*outgoing[i]->event)) {
             return;
         }
     }
+    PropertyVars vars = outgoing.front()->event->vars;
+    for (size_t i = 1; i < outgoing.size(); i++) {
+        mergeVars(vars, outgoing[i]->event->vars);
+    }
+    auto& head = *outgoing.front();
+    auto merged = std::make_shared<GenaEvent>(
+        head.event->servId, head.event->UDN, propertySetFromVars(vars));
+    merged->varsState = GenaEvent::VARS_OK;
+    merged->vars = std::move(vars);
+    head.event = std::move(merged);
+    head.ctime = outgoing.back()->ctime;
+    while (outgoing.size() > 1) {
+        outgoing.erase(1);
+    }
+    sub->outgoingBytes = 0;
+}
 
-    /* send the notify */
-    return_code = genaNotify(m_input->propertySet, &sub_copy);
+void NotifyResumeJobWorker::work()
+{
+    struct Handle_Info *handle_info;
+    service_info *service;
+    subscription *sub;
+
+    HANDLELOCK();
+    if (GetHandleInfo(m_hnd, &handle_info) != HND_DEVICE ||
+        !(service = FindServiceId(handle_info->serviceTable, m_servid, m_udn)) ||
+        !service->active || !(sub = GetSubscriptionSID(m_sid, service)) ||
+        sub->suspendedUntil == 0) {
+        return;
+    }
+    sub->suspendedUntil = 0;
+    if (sub->outgoing.empty()) {
+        return;
+    }
+    coalesceQueue(sub);
+    if (genaStartNotify(sub->outgoing.front(), sub) != UPNP_E_SUCCESS) {
+        UpnpPrintf(UPNP_ERROR, GENA, __FILE__, __LINE__,
+                   "Could not restart the event delivery to %s\n", m_sid.c_str());
+        while (!sub->outgoing.empty()) {
+            sub->outgoing.pop_front();
+        }
+        sub->outgoingBytes = 0;
+    }
+}
+
+/*!
+ * \brief Completion of a notification transfer.
+ *
+ * Updates the subscription event key, and starts sending the next
+ * queued event, if any.
+ */
+static void genaNotifyDone(const std::shared_ptr<Notification>& notif, int return_code)
+{
+    subscription *sub;
+    service_info *service;
+    struct Handle_Info *handle_info;
 
     HANDLELOCK();
-    if (GetHandleInfo(m_input->device_handle, &handle_info) != HND_DEVICE) {
+    if (GetHandleInfo(notif->device_handle, &handle_info) != HND_DEVICE) {
         return;
     }
     /* validate context */
-    if (!(service = FindServiceId(handle_info->serviceTable, m_input->servId, m_input->UDN)) ||
+    if (!(service = FindServiceId(
+              handle_info->serviceTable, notif->event->servId, notif->event->UDN)) ||
         !service->active ||
-        !(sub = GetSubscriptionSID(m_input->sid, service))) {
+        !(sub = GetSubscriptionSID(notif->sid, service))) {
         return;
     }
     sub->ToSendEventKey++;
@@ -265,24 +1006,40 @@ void GenaNotifyJobWorker::work()
         /* wrap to 1 for overflow */
         sub->ToSendEventKey = 1;
 
+    if (return_code == UPNP_E_SUCCESS) {
+        sub->delivered++;
+        sub->consecutiveFailures = 0;
+        sub->lastSuccess = time(nullptr);
+        sub->lastLatencyMs = static_cast<int>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - notif->sendtime).count());
+    } else if (return_code != GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB) {
+        sub->failed++;
+        if (++sub->consecutiveFailures >= GENA_NOTIFY_FAILURES_BEFORE_BACKOFF) {
+            // Stop sending to this subscriber for a while. The failed event
+            // is kept and merged with the next ones for the retry.
+            if (suspendDelivery(*notif, sub)) {
+                return;
+            }
+        }
+    }
+
     /* Remove head of event queue. */
     if (!sub->outgoing.empty()) {
         sub->outgoing.pop_front();
     }
     /* Possibly activate next */
     if (!sub->outgoing.empty()) {
-        auto notif = sub->outgoing.begin();
-        auto worker = std::make_unique<GenaNotifyJobWorker>(*notif);
-        gSendThreadPool.addJob(std::move(worker));
+        // Not pending any more, can't be merged into
+        sub->outgoingBytes -= sub->outgoing.front()->event->propertySet.size();
+        genaStartNotify(sub->outgoing.front(), sub);
     }
 
     // No idea why we do this after sending one more event. Was the
     // same in pupnp. It would seem saner to call this right after we
-    // get the error and do nothing else? Would have to take care with
-    // the first Notif then, because it's the only case where it's not
-    // managed by a ThreadPool Job (potentially creating a mem leak).
+    // get the error and do nothing else?
     if (return_code == GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB)
-        RemoveSubscriptionSID(m_input->sid, service);
+        RemoveSubscriptionSID(notif->sid, service);
 }
 
 
@@ -326,16 +1083,12 @@ int genaInitNotifyXML(
     }
     sub->active = 1;
 
-    /* schedule thread for initial notification */
+    /* send the initial notification */
     thread_struct = std::make_shared<Notification>(
-        servId, UDN, propertySet, sid, time(nullptr), device_handle);
-    {
-        auto worker = std::make_unique<GenaNotifyJobWorker>(thread_struct);
-        ret = gSendThreadPool.addJob(std::move(worker));
-    }
-    if (ret != 0) {
+        std::make_shared<GenaEvent>(servId, UDN, propertySet), sid, time(nullptr), device_handle);
+    ret = genaStartNotify(thread_struct, sub);
+    if (ret != UPNP_E_SUCCESS) {
         line = __LINE__;
-        ret = UPNP_E_OUTOF_MEMORY;
     } else {
         line = __LINE__;
         sub->outgoing.push_back(thread_struct);
@@ -381,41 +1134,164 @@ ExitFunction:
     return ret;
 }
 
+static bool eventVars(const GenaEvent& event)
+{
+    if (event.varsState == GenaEvent::VARS_UNKNOWN) {
+        event.varsState = parsePropertySet(event.propertySet, event.vars) ?
+            GenaEvent::VARS_OK : GenaEvent::VARS_BAD;
+    }
+    return event.varsState == GenaEvent::VARS_OK;
+}
+
+/* Merge the variables from a new event into a pending one, the last value wins */
+static void mergeVars(PropertyVars& into, const PropertyVars& from)
+{
+    for (const auto& [name, value] : from) {
+        auto it = std::find_if(into.begin(), into.end(),
+                               [&name = name](const auto& v) { return v.first == name; });
+        if (it != into.end()) {
+            it->second = value;
+        } else {
+            into.emplace_back(name, value);
+        }
+    }
+}
+
 /*
- * This gets called before queuing a new event, with the handLock held.
- * - The list size can never go over MAX_SUBSCRIPTION_QUEUED_EVENTS so we
- *   discard the oldest non-active event if it is already at the max
- * - We also discard any non-active event older than MAX_SUBSCRIPTION_EVENT_AGE.
- * non-active: any but the head of queue, which is already copied to
- * the thread pool
+ * Queue an event for a subscription. This gets called with the
+ * handLock held.
+ * - If the last queued event is pending (not being sent), the new one
+ *   is merged into it variable by variable, the last value winning
+ *   (e.g. for a LastChange variable, only the latest state is sent).
+ * - Else the event is appended. Pending events older than
+ *   MAX_SUBSCRIPTION_EVENT_AGE are discarded, and so are the oldest
+ *   pending ones if the ring is full or the pending property sets
+ *   would use more than MAX_SUBSCRIPTION_QUEUED_BYTES.
+ * The head of queue is being sent and is never touched.
+ *
+ * Returns true if the queue was empty, and the event must be sent now.
  */
-static void maybeDiscardEvents(std::list<std::shared_ptr<Notification>>& outgoing)
+static bool queueEvent(subscription *sub, std::shared_ptr<Notification> notif)
 {
+    auto& outgoing = sub->outgoing;
+    if (outgoing.empty()) {
+        outgoing.push_back(std::move(notif));
+        return true;
+    }
+
+    if (outgoing.size() > 1) {
+        auto& last = *outgoing.back();
+        if (eventVars(*last.event) && eventVars(*notif->event)) {
+            // The event data may be shared with other subscriptions: merge into a copy.
+            PropertyVars vars = last.event->vars;
+            mergeVars(vars, notif->event->vars);
+            auto merged = std::make_shared<GenaEvent>(
+                last.event->servId, last.event->UDN, propertySetFromVars(vars));
+            merged->varsState = GenaEvent::VARS_OK;
+            merged->vars = std::move(vars);
+            sub->outgoingBytes -= last.event->propertySet.size();
+            sub->outgoingBytes += merged->propertySet.size();
+            last.event = std::move(merged);
+            last.ctime = notif->ctime;
+            return false;
+        }
+    }
+
     time_t now = time(nullptr);
+    auto size = notif->event->propertySet.size();
+    while (outgoing.size() > 1 &&
+           (outgoing.full() || now - outgoing[1]->ctime > g_UpnpSdkEQMaxAge ||
+            sub->outgoingBytes + size > g_UpnpSdkEQMaxBytes)) {
+        sub->outgoingBytes -= outgoing[1]->event->propertySet.size();
+        outgoing.erase(1);
+    }
+    sub->outgoingBytes += size;
+    outgoing.push_back(std::move(notif));
+    return false;
+}
 
-    auto it = outgoing.begin();
-    // Skip first event: it's in the pool already
-    if (it != outgoing.end())
-        it++;
-    while (it != outgoing.end()) {
-        if (outgoing.size() > unsigned(g_UpnpSdkEQMaxLen) ||
-            now - (*it)->ctime > g_UpnpSdkEQMaxAge) {
-            it = outgoing.erase(it);
-        } else {
-            /* If the list is smaller than the max and the oldest
-             * task is young enough, stop pruning */
-            break;
+#if EXCLUDE_SSDP == 0
+/* Send the multicast variables from an event in a UDA 2.0 multicast
+   event. Called with the handle lock held. */
+static void sendMulticastEvent(service_info *service, const GenaEvent& event)
+{
+    if (!eventVars(event)) {
+        return;
+    }
+    const auto& mvars = service->multicastVars;
+    PropertyVars vars;
+    for (const auto& var : event.vars) {
+        if (std::find(mvars.begin(), mvars.end(), var.first) != mvars.end()) {
+            vars.push_back(var);
+        }
+    }
+    if (vars.empty()) {
+        return;
+    }
+    std::string headers = std::string("CONTENT-TYPE: text/xml; charset=\"utf-8\"\r\n") +
+        "USN: " + service->UDN + "::" + service->serviceType + "\r\n" +
+        "SVCID: " + service->serviceId + "\r\n" +
+        "NT: upnp:event\r\n"
+        "NTS: upnp:propchange\r\n"
+        "SEQ: " + std::to_string(service->multicastSeq) + "\r\n" +
+        "LVL: " + service->multicastLevel + "\r\n" +
+        "BOOTID.UPNP.ORG: " + std::to_string(g_bootidUpnpOrg) + "\r\n";
+    if (ssdpSendMulticastEvent(headers, propertySetFromVars(vars)) == UPNP_E_SUCCESS) {
+        if (++service->multicastSeq == 0) {
+            /* wrap to 1 for overflow */
+            service->multicastSeq = 1;
         }
     }
 }
+#endif /* EXCLUDE_SSDP */
+
+/*
+ * Queue an event for all the active subscriptions to a service, and
+ * start sending where the queue was empty. Called with the handle
+ * lock held.
+ */
+static int notifySubscribers(UpnpDevice_Handle device_handle, service_info *service,
+                             const std::shared_ptr<const GenaEvent>& event,
+                             NotifyBatch *batch = nullptr)
+{
+#if EXCLUDE_SSDP == 0
+    if (!service->multicastVars.empty()) {
+        sendMulticastEvent(service, *event);
+    }
+#endif /* EXCLUDE_SSDP */
+    auto finger = GetFirstSubscription(service);
+    while (finger != service->subscriptionList.end()) {
+        auto thread_struct = std::make_shared<Notification>(
+            event, finger->sid, time(nullptr), device_handle);
+
+        /* If the queue was empty, start sending */
+        if (queueEvent(&(*finger), thread_struct)) {
+            if (batch) {
+                auto transfer = makeNotifyTransfer(thread_struct, &(*finger));
+                if (!transfer) {
+                    finger->outgoing.pop_front();
+                    return UPNP_E_INVALID_PARAM;
+                }
+                batch->subs.push_back(&(*finger));
+                batch->transfers.push_back(std::move(transfer));
+            } else {
+                int ret = genaStartNotify(thread_struct, &(*finger));
+                if (ret != UPNP_E_SUCCESS) {
+                    finger->outgoing.pop_front();
+                    return ret;
+                }
+            }
+        }
+        finger = GetNextSubscription(service, finger);
+    }
+    return UPNP_E_SUCCESS;
+}
 
 int genaNotifyAllXML(
-    UpnpDevice_Handle device_handle, char *UDN, char *servId, const std::string& propertySet)
+    UpnpDevice_Handle device_handle, char *UDN, char *servId, std::string propertySet)
 {
     int ret = UPNP_E_SUCCESS;
     int line = 0;
-    std::list<subscription>::iterator finger;
-    std::shared_ptr<Notification> thread_struct;
     service_info *service = nullptr;
     struct Handle_Info *handle_info;
 
@@ -437,27 +1313,11 @@ int genaNotifyAllXML(
         goto ExitFunction;
     }
 
-    finger = GetFirstSubscription(service);
-    while (finger != service->subscriptionList.end()) {
-        thread_struct = std::make_shared<Notification>(
-            servId, UDN, propertySet, finger->sid, time(nullptr), device_handle);
-        maybeDiscardEvents(finger->outgoing);
-        finger->outgoing.push_back(thread_struct);
-
-        /* If there is only one element on the list (just added), kickstart the threadpool */
-        if (finger->outgoing.size() == 1) {
-            auto worker = std::make_unique<GenaNotifyJobWorker>(thread_struct);
-            ret = gSendThreadPool.addJob(std::move(worker));
-            if (ret != 0) {
-                line = __LINE__;
-                if (ret == EOUTOFMEM) {
-                    line = __LINE__;
-                    ret = UPNP_E_OUTOF_MEMORY;
-                }
-                break;
-            }
-        }
-        finger = GetNextSubscription(service, finger);
+    // One copy of the event data for all the subscriptions
+    ret = notifySubscribers(
+        device_handle, service, std::make_shared<GenaEvent>(servId, UDN, std::move(propertySet)));
+    if (ret != UPNP_E_SUCCESS) {
+        line = __LINE__;
     }
 
 ExitFunction:
@@ -465,6 +1325,44 @@ ExitFunction:
     return ret;
 }
 
+int genaNotifyBatch(UpnpDevice_Handle device_handle,
+                    const std::vector<UpnpNotifyBatchEntry>& entries)
+{
+    struct Handle_Info *handle_info;
+
+    HANDLELOCK();
+
+    if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    // Resolve all the services first, so that nothing is sent if one is wrong
+    std::vector<service_info*> services;
+    services.reserve(entries.size());
+    for (const auto& entry : entries) {
+        auto service = FindServiceId(handle_info->serviceTable, entry.serviceId, entry.UDN);
+        if (service == nullptr) {
+            UpnpPrintf(UPNP_ERROR, GENA, __FILE__, __LINE__, "genaNotifyBatch: no service %s %s\n",
+                       entry.UDN.c_str(), entry.serviceId.c_str());
+            return UPNP_E_INVALID_SERVICE;
+        }
+        services.push_back(service);
+    }
+
+    NotifyBatch batch;
+    int ret = UPNP_E_SUCCESS;
+    for (size_t i = 0; i < entries.size(); i++) {
+        auto event = std::make_shared<GenaEvent>(
+            entries[i].serviceId, entries[i].UDN, entries[i].propertySet);
+        ret = notifySubscribers(device_handle, services[i], event, &batch);
+        if (ret != UPNP_E_SUCCESS) {
+            break;
+        }
+    }
+    // Submit what was queued, even after an error, else the subscription queues would be stuck
+    int ret1 = submitBatch(batch);
+    return ret != UPNP_E_SUCCESS ? ret : ret1;
+}
+
 int genaNotifyAll(
     UpnpDevice_Handle device_handle,
     char *UDN,
@@ -485,7 +1383,7 @@ int genaNotifyAll(
         goto ExitFunction;
     }
 
-    ret = genaNotifyAllXML(device_handle, UDN, servId, propertySet);
+    ret = genaNotifyAllXML(device_handle, UDN, servId, std::move(propertySet));
 
 ExitFunction:
     UpnpPrintf(UPNP_ALL, GENA, __FILE__, line, "genaNotifyAll ret = %d\n", ret);
@@ -493,6 +1391,234 @@ ExitFunction:
 }
 
 
+static StateVariable *findStateVar(service_info *service, const std::string& name, bool create)
+{
+    auto& vars = service->stateVars;
+    auto it = std::find_if(vars.begin(), vars.end(),
+                           [&name](const StateVariable& v) { return v.name == name; });
+    if (it != vars.end()) {
+        return &(*it);
+    }
+    if (!create) {
+        return nullptr;
+    }
+    vars.emplace_back();
+    vars.back().name = name;
+    return &vars.back();
+}
+
+static bool numericValue(const std::string& value, double *d)
+{
+    if (value.empty()) {
+        return false;
+    }
+    char *endp;
+    *d = strtod(value.c_str(), &endp);
+    return *endp == 0;
+}
+
+/* Check if a new value changes a variable enough to be evented (minDelta) */
+static bool stateVarChanged(const StateVariable& var, const std::string& value)
+{
+    if (!var.sent) {
+        return true;
+    }
+    if (value == var.sentValue) {
+        return false;
+    }
+    double oldv, newv;
+    if (var.minDelta > 0 && numericValue(var.sentValue, &oldv) && numericValue(value, &newv)) {
+        return std::fabs(newv - oldv) >= var.minDelta;
+    }
+    return true;
+}
+
+static void scheduleStateFlush(UpnpDevice_Handle device_handle, service_info *service,
+                               std::chrono::milliseconds delay);
+
+/*
+ * Send an event with the pending state variables which are not held
+ * back by their maxRate, and set a timer for the others. Called with
+ * the handle lock held.
+ */
+static int flushStateVariables(UpnpDevice_Handle device_handle, service_info *service)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::milliseconds nextdelay{-1};
+    PropertyVars vars;
+    for (auto& var : service->stateVars) {
+        if (!var.pending) {
+            continue;
+        }
+        if (var.sent && var.maxRateMs > 0) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                now - var.lastSent);
+            std::chrono::milliseconds remaining{var.maxRateMs - elapsed.count()};
+            if (remaining.count() > 0) {
+                if (nextdelay.count() < 0 || remaining < nextdelay) {
+                    nextdelay = remaining;
+                }
+                continue;
+            }
+        }
+        vars.emplace_back(var.name, var.value);
+        var.sentValue = var.value;
+        var.sent = true;
+        var.lastSent = now;
+        var.pending = false;
+    }
+    // Arm a timer unless one is already set to fire early enough. A
+    // later timer may stay armed, it will just find nothing to do.
+    if (nextdelay.count() >= 0 &&
+        (service->stateFlushDeadline == std::chrono::steady_clock::time_point() ||
+         now + nextdelay < service->stateFlushDeadline)) {
+        scheduleStateFlush(device_handle, service, nextdelay);
+    }
+    if (vars.empty()) {
+        return UPNP_E_SUCCESS;
+    }
+    return notifySubscribers(device_handle, service, std::make_shared<GenaEvent>(
+                                 service->serviceId, service->UDN, propertySetFromVars(vars)));
+}
+
+class StateFlushJobWorker : public JobWorker {
+public:
+    StateFlushJobWorker(UpnpDevice_Handle hnd, std::string servid, std::string udn,
+                        std::chrono::steady_clock::time_point deadline)
+        : m_hnd(hnd), m_servid(std::move(servid)), m_udn(std::move(udn)),
+          m_deadline(deadline) {}
+    void work() override {
+        struct Handle_Info *handle_info;
+        service_info *service;
+        HANDLELOCK();
+        if (GetHandleInfo(m_hnd, &handle_info) != HND_DEVICE ||
+            !(service = FindServiceId(handle_info->serviceTable, m_servid, m_udn))) {
+            return;
+        }
+        if (service->stateFlushDeadline <= m_deadline) {
+            service->stateFlushDeadline = std::chrono::steady_clock::time_point();
+        }
+        flushStateVariables(m_hnd, service);
+    }
+private:
+    UpnpDevice_Handle m_hnd;
+    std::string m_servid;
+    std::string m_udn;
+    std::chrono::steady_clock::time_point m_deadline;
+};
+
+static void scheduleStateFlush(UpnpDevice_Handle device_handle, service_info *service,
+                               std::chrono::milliseconds delay)
+{
+    auto deadline = std::chrono::steady_clock::now() + delay;
+    auto worker = std::make_unique<StateFlushJobWorker>(
+        device_handle, service->serviceId, service->UDN, deadline);
+    if (gTimerThread->schedule(TimerThread::SHORT_TERM, delay, nullptr,
+                               std::move(worker)) == UPNP_E_SUCCESS) {
+        service->stateFlushDeadline = deadline;
+    }
+}
+
+int genaSetStateVariables(
+    UpnpDevice_Handle device_handle, const char *UDN, const char *servId,
+    const char **names, const char **values, int count)
+{
+    struct Handle_Info *handle_info;
+    service_info *service;
+
+    HANDLELOCK();
+    if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    if (!(service = FindServiceId(handle_info->serviceTable, servId, UDN))) {
+        return UPNP_E_INVALID_SERVICE;
+    }
+    for (int i = 0; i < count; i++) {
+        if (nullptr == names[i] || nullptr == values[i]) {
+            return UPNP_E_INVALID_PARAM;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        auto var = findStateVar(service, names[i], true);
+        var->value = values[i];
+        var->hasValue = true;
+        // A change below minDelta is recorded, but does not trigger an
+        // event (nor cancel one which is already pending).
+        if (stateVarChanged(*var, var->value)) {
+            var->pending = true;
+        } else if (var->value == var->sentValue) {
+            var->pending = false;
+        }
+    }
+    return flushStateVariables(device_handle, service);
+}
+
+int genaSetStateVariableModeration(
+    UpnpDevice_Handle device_handle, const char *UDN, const char *servId,
+    const char *name, int maxRateMs, double minDelta)
+{
+    struct Handle_Info *handle_info;
+    service_info *service;
+
+    HANDLELOCK();
+    if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    if (!(service = FindServiceId(handle_info->serviceTable, servId, UDN))) {
+        return UPNP_E_INVALID_SERVICE;
+    }
+    auto var = findStateVar(service, name, true);
+    var->maxRateMs = maxRateMs;
+    var->minDelta = minDelta;
+    return UPNP_E_SUCCESS;
+}
+
+int genaSetMulticastEventing(
+    UpnpDevice_Handle device_handle, const char *UDN, const char *servId,
+    const std::vector<std::string>& names, const char *level)
+{
+    struct Handle_Info *handle_info;
+    service_info *service;
+
+    HANDLELOCK();
+    if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) {
+        return UPNP_E_INVALID_HANDLE;
+    }
+    if (!(service = FindServiceId(handle_info->serviceTable, servId, UDN))) {
+        return UPNP_E_INVALID_SERVICE;
+    }
+    service->multicastVars = names;
+    service->multicastLevel = level ? level : "upnp:/general";
+    return UPNP_E_SUCCESS;
+}
+
+static bool hasManagedState(const service_info *service)
+{
+    return std::any_of(service->stateVars.begin(), service->stateVars.end(),
+                       [](const StateVariable& v) { return v.hasValue; });
+}
+
+/* Accept a new subscription to a service with a library-managed
+   state: send the current values. Called with the handle lock held. */
+static int acceptFromState(UpnpDevice_Handle device_handle, service_info *service,
+                           subscription *sub)
+{
+    PropertyVars vars;
+    for (const auto& var : service->stateVars) {
+        if (var.hasValue) {
+            vars.emplace_back(var.name, var.value);
+        }
+    }
+    sub->active = 1;
+    auto notif = std::make_shared<Notification>(
+        std::make_shared<GenaEvent>(service->serviceId, service->UDN, propertySetFromVars(vars)),
+        sub->sid, time(nullptr), device_handle);
+    if (queueEvent(sub, notif)) {
+        return genaStartNotify(notif, sub);
+    }
+    return UPNP_E_SUCCESS;
+}
+
 /*!
  * \brief Returns OK message in the case of a subscription request.
  *
@@ -509,6 +1635,7 @@ static int respond_ok(MHDTransaction *mhdt, int time_out, subscription *sub,
         ts << "Second-" << "Second-infinite";
     }
     mhdt->httpstatus = HTTP_OK;
+    mhdt->respsize = 0;
     mhdt->response =
         MHD_create_response_from_buffer(0, nullptr, MHD_RESPMEM_PERSISTENT);
     MHD_add_response_header(mhdt->response,    "SID", sub->sid.c_str());
@@ -721,13 +1848,7 @@ void gena_process_subscription_request(MHDTransaction *mhdt)
         }
 
         /* generate new subscription */
-        auto sub = service->subscriptionList.emplace(service->subscriptionList.end());
-        if (sub == service->subscriptionList.end()) {
-            http_SendStatusResponse(mhdt, HTTP_INTERNAL_SERVER_ERROR);
-            return;
-        }
-
-        sub->DeliveryURLs = tmpUrls;
+        subscription newsub;
         /* set the timeout */
         if (!timeout_header_value(mhdt->headers, &time_out)) {
             time_out = GENA_DEFAULT_TIMEOUT;
@@ -740,23 +1861,33 @@ void gena_process_subscription_request(MHDTransaction *mhdt)
             }
         }
         if (time_out >= 0) {
-            sub->expireTime = time(nullptr) + time_out;
+            newsub.expireTime = time(nullptr) + time_out;
         } else {
             /* infinite time */
-            sub->expireTime = 0;
+            newsub.expireTime = 0;
         }
 
         /* generate SID */
-        sub->sid = std::string("uuid:") + gena_sid_uuid();
+        newsub.sid = std::string("uuid:") + gena_sid_uuid();
+        newsub.delivery = std::make_shared<DeliveryTarget>(newsub.sid, std::move(tmpUrls));
 
         /* respond OK */
-        if (respond_ok(mhdt, time_out, &(*sub), handle_info->productversion) != UPNP_E_SUCCESS) {
-            service->subscriptionList.pop_back();
+        if (respond_ok(mhdt, time_out, &newsub, handle_info->productversion) != UPNP_E_SUCCESS) {
+            return;
+        }
+        auto sub = AddSubscription(service, std::move(newsub));
+        if (sub == service->subscriptionList.end()) {
             return;
         }
-        service->TotalSubscriptions++;
+        scheduleExpiry(sub->expireTime);
         UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__, "Subscription Request granted\n");
 
+        if (hasManagedState(service)) {
+            /* The library has the state: no need to involve the application */
+            acceptFromState(device_handle, service, &(*sub));
+            return;
+        }
+
         /* finally generate callback for init table dump */
         request_struct = Upnp_Subscription_Request{
             service->serviceId.c_str(), service->UDN.c_str(), sub->sid};
@@ -836,9 +1967,10 @@ void gena_process_subscription_renewal_request(MHDTransaction *mhdt)
     }
 
     if(time_out == -1) {
-        sub->expireTime = 0;
+        SetSubscriptionExpiry(service, sub, 0);
     } else {
-        sub->expireTime = time(nullptr) + time_out;
+        SetSubscriptionExpiry(service, sub, time(nullptr) + time_out);
+        scheduleExpiry(sub->expireTime);
     }
 
     if (respond_ok(mhdt, time_out, sub, handle_info->productversion) != UPNP_E_SUCCESS) {
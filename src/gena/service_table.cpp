@@ -49,28 +49,64 @@
 #ifdef INCLUDE_DEVICE_APIS
 
 #if EXCLUDE_GENA == 0
-/************************************************************************
- *    Function :    copy_subscription
- *
- *    Parameters :
- *        subscription *in ;    Source subscription
- *        subscription *out ;    Destination subscription
- *
- *    Description :    Makes a copy of the subscription
- *
- *    Return : int ;
- *        UPNP_E_SUCCESS - On success
- *
- *    Note :
- ************************************************************************/
-int copy_subscription(const subscription *in, subscription *out)
+std::list<subscription>::iterator AddSubscription(service_info *service, subscription&& sub)
+{
+    auto& sublist(service->subscriptionList);
+    if (service->subscriptionsBySid.find(sub.sid) != service->subscriptionsBySid.end()) {
+        UpnpPrintf(UPNP_ERROR, GENA, __FILE__, __LINE__,
+                   "AddSubscription: duplicate SID %s\n", sub.sid.c_str());
+        return sublist.end();
+    }
+    auto it = sublist.insert(sublist.end(), std::move(sub));
+    service->subscriptionsBySid[it->sid] = it;
+    if (it->expireTime != 0) {
+        service->subscriptionsByExpiry.emplace(it->expireTime, &(*it));
+    }
+    service->TotalSubscriptions++;
+    return it;
+}
+
+void SetSubscriptionExpiry(service_info *service, subscription *sub, time_t expireTime)
+{
+    if (sub->expireTime != 0) {
+        service->subscriptionsByExpiry.erase({sub->expireTime, sub});
+    }
+    sub->expireTime = expireTime;
+    if (expireTime != 0) {
+        service->subscriptionsByExpiry.emplace(expireTime, sub);
+    }
+}
+
+static void eraseSubscription(service_info *service, std::list<subscription>::iterator it)
 {
-    out->sid = in->sid;
-    out->ToSendEventKey = in->ToSendEventKey;
-    out->expireTime = in->expireTime;
-    out->active = in->active;
-    out->DeliveryURLs = in->DeliveryURLs;
-    return UPNP_E_SUCCESS;
+    if (it->expireTime != 0) {
+        service->subscriptionsByExpiry.erase({it->expireTime, &(*it)});
+    }
+    service->subscriptionsBySid.erase(it->sid);
+    service->subscriptionList.erase(it);
+    service->TotalSubscriptions--;
+}
+
+int ExpireSubscriptions(service_info *service, time_t now)
+{
+    int count = 0;
+    auto& byexpiry(service->subscriptionsByExpiry);
+    while (!byexpiry.empty() && byexpiry.begin()->first < now) {
+        const auto& sid = byexpiry.begin()->second->sid;
+        auto found = service->subscriptionsBySid.find(sid);
+        if (found == service->subscriptionsBySid.end()) {
+            // Should not happen: the indexes are maintained together
+            UpnpPrintf(UPNP_ERROR, GENA, __FILE__, __LINE__,
+                       "ExpireSubscriptions: %s not in the SID index\n", sid.c_str());
+            byexpiry.erase(byexpiry.begin());
+            continue;
+        }
+        UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__,
+                   "ExpireSubscriptions: erasing expired subscription %s\n", sid.c_str());
+        eraseSubscription(service, found->second);
+        count++;
+    }
+    return count;
 }
 
 /************************************************************************
@@ -92,38 +128,32 @@ int copy_subscription(const subscription *in, subscription *out)
 void RemoveSubscriptionSID(const Upnp_SID& sid, service_info *service)
 {
     UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__, "RemoveSubscriptionSID\n");
-    auto& sublist(service->subscriptionList);
-    for (auto it = sublist.begin(); it != sublist.end(); ) {
-        if (sid == it->sid) {
-            UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__, "RemoveSubscriptionSID: found\n");
-            it = sublist.erase(it);
-            service->TotalSubscriptions--;
-        } else {
-            it++;
-        }
+    auto found = service->subscriptionsBySid.find(sid);
+    if (found != service->subscriptionsBySid.end()) {
+        UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__, "RemoveSubscriptionSID: found\n");
+        eraseSubscription(service, found->second);
     }
 }
 
 
 subscription *GetSubscriptionSID(const Upnp_SID& sid, service_info *service)
 {
-    auto& sublist(service->subscriptionList);
-    auto found = find_if(sublist.begin(), sublist.end(),
-                         [sid](const subscription& s)->bool{return sid == s.sid;});
-    if (found == sublist.end()) {
+    auto found = service->subscriptionsBySid.find(sid);
+    if (found == service->subscriptionsBySid.end()) {
         return nullptr;
     }
+    auto it = found->second;
     /*get the current_time */
     time_t current_time = time(nullptr);
-    if ((found->expireTime != 0) && (found->expireTime < current_time)) {
+    if ((it->expireTime != 0) && (it->expireTime < current_time)) {
         UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__,
                    "GetSubscriptionSID: erasing expired subscription\n");
-        sublist.erase(found);
-        service->TotalSubscriptions--;
+        eraseSubscription(service, it);
+        service->expiredOnAccess++;
         return nullptr;
     }
 
-    return &(*found);
+    return &(*it);
 }
 
 std::list<subscription>::iterator GetNextSubscription(
@@ -131,28 +161,18 @@ std::list<subscription>::iterator GetNextSubscription(
 {
     auto& sublist(service->subscriptionList);
 
-    time_t current_time = time(nullptr);
     if (!getfirst) {
         current++;
     }
-    while (current != sublist.end()) {
-        if ((current->expireTime != 0)
-            && (current->expireTime < current_time)) {
-            UpnpPrintf(UPNP_DEBUG, GENA, __FILE__, __LINE__,
-                       "GetNextSubscription: erasing expired subscription\n");
-            current = sublist.erase(current);
-            service->TotalSubscriptions--;
-        } else if (current->active) {
-            return current;
-        } else {
-            current++;
-        }
+    while (current != sublist.end() && !current->active) {
+        current++;
     }
-    return sublist.end();
+    return current;
 }
 
 std::list<subscription>::iterator GetFirstSubscription(service_info *service)
 {
+    service->expiredOnAccess += ExpireSubscriptions(service, time(nullptr));
     auto& sublist(service->subscriptionList);
     return GetNextSubscription(service, sublist.begin(), true);
 }
@@ -167,7 +187,7 @@ std::list<subscription>::iterator GetFirstSubscription(service_info *service)
  *        const std::string& UDN ;        string representing the UDN 
  *                                to be found among those in the table    
  *
- *    Description :    Traverses through the service table and returns a 
+ *    Description :    Looks up the service table index and returns a 
  *        pointer to the service node that matches a known service  id 
  *        and a known UDN
  *
@@ -175,14 +195,16 @@ std::list<subscription>::iterator GetFirstSubscription(service_info *service)
  *
  *    Note :
  ************************************************************************/
+static std::string serviceIdKey(const std::string& serviceId, const std::string& UDN)
+{
+    return UDN + " " + serviceId;
+}
+
 service_info *FindServiceId(
     service_table& table, const std::string& serviceId, const std::string& UDN)
 {
-    for (auto& si : table)
-        if ((serviceId == si.serviceId) && (UDN == si.UDN))
-            return &si;
-
-    return nullptr;
+    auto it = table.byId.find(serviceIdKey(serviceId, UDN));
+    return it == table.byId.end() ? nullptr : it->second;
 }
 
 /************************************************************************
@@ -193,7 +215,7 @@ service_info *FindServiceId(
  *        char * eventURLPath ;    event URL path used to find a service 
  *                                from the table    
  *
- *    Description :    Traverses the service table and finds the node whose
+ *    Description :    Looks up the service table index for the node whose
  *        event URL Path matches a know value 
  *
  *    Return : service_info * - pointer to the service list node from the 
@@ -203,29 +225,24 @@ service_info *FindServiceId(
  ************************************************************************/
 service_info *FindServiceEventURLPath(service_table& table, const std::string& eventURLPath)
 {
-    uri_type parsed_url_in;
-    if (parse_uri(eventURLPath, &parsed_url_in)
-        != UPNP_E_SUCCESS) {
+    std::string key;
+    if (!servicePathKey(eventURLPath, key)) {
         return nullptr;
     }
+    auto it = table.byEventPath.find(key);
+    return it == table.byEventPath.end() ? nullptr : it->second;
+}
+#endif /* EXCLUDE_GENA */
 
-    for (auto& entry : table) {
-        if (entry.eventURL.empty()) {
-            continue;
-        }
-        uri_type parsed_url;
-        if (parse_uri(entry.eventURL, &parsed_url) != UPNP_E_SUCCESS) {
-            continue;
-        }
-        if (parsed_url.path == parsed_url_in.path &&
-            parsed_url.query == parsed_url_in.query) {
-            return &entry;
-        }
+bool servicePathKey(const std::string& url, std::string& key)
+{
+    uri_type parsed_url;
+    if (parse_uri(url, &parsed_url) != UPNP_E_SUCCESS) {
+        return false;
     }
-
-    return nullptr;
+    key = parsed_url.path + "?" + parsed_url.query;
+    return true;
 }
-#endif /* EXCLUDE_GENA */
 
 /************************************************************************
  *    Function :    FindServiceControlURLPath
@@ -235,7 +252,7 @@ service_info *FindServiceEventURLPath(service_table& table, const std::string& e
  *        char * controlURLPath ;    control URL path used to find a service 
  *                                from the table    
  *
- *    Description :    Traverses the service table and finds the node whose
+ *    Description :    Looks up the service table index for the node whose
  *        control URL Path matches a know value 
  *
  *    Return : service_info * - pointer to the service list node from the 
@@ -247,27 +264,12 @@ service_info *FindServiceEventURLPath(service_table& table, const std::string& e
 service_info *FindServiceControlURLPath(
     service_table& table, const std::string& controlURLPath)
 {
-    uri_type parsed_url_in;
-    if (parse_uri(controlURLPath, &parsed_url_in)
-        != UPNP_E_SUCCESS) {
+    std::string key;
+    if (!servicePathKey(controlURLPath, key)) {
         return nullptr;
     }
-
-    for (auto& entry : table) {
-        if (entry.controlURL.empty()) {
-            continue;
-        }
-        uri_type parsed_url;
-        if ((parse_uri(entry.controlURL, &parsed_url) != UPNP_E_SUCCESS)) {
-            continue;
-        }
-        if (parsed_url.path == parsed_url_in.path &&
-            parsed_url.query == parsed_url_in.query) {
-            return &entry;
-        }
-    }
-
-    return nullptr;
+    auto it = table.byControlPath.find(key);
+    return it == table.byControlPath.end() ? nullptr : it->second;
 }
 #endif /* EXCLUDE_SOAP */
 
@@ -373,7 +375,7 @@ static int fillServiceList(const UPnPDeviceDesc& dev, service_table& stable)
 
     for (const UPnPServiceDesc& sdesc : dev.services) {
         int fail = 0;
-        auto current = stable.emplace(stable.end());
+        auto current = stable.services.emplace(stable.services.end());
         current->active = 1;
         current->UDN = dev.UDN;
         current->serviceType = sdesc.serviceType;
@@ -396,7 +398,7 @@ static int fillServiceList(const UPnPDeviceDesc& dev, service_table& stable)
             UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__, "Bad/No EVENT URL");
         }
         if (fail) {
-            stable.erase(current);
+            stable.services.erase(current);
         }
     }
     return !stable.empty();
@@ -422,6 +424,18 @@ int initServiceTable(const UPnPDeviceDesc& devdesc, service_table& out)
     for (const auto& dev : devdesc.embedded) {
         fillServiceList(dev, out);
     }
+    // Build the indexes. If there are duplicates, the first entry wins, as
+    // with the previous linear searches.
+    std::string key;
+    for (auto& entry : out.services) {
+        out.byId.emplace(serviceIdKey(entry.serviceId, entry.UDN), &entry);
+        if (!entry.controlURL.empty() && servicePathKey(entry.controlURL, key)) {
+            out.byControlPath.emplace(key, &entry);
+        }
+        if (!entry.eventURL.empty() && servicePathKey(entry.eventURL, key)) {
+            out.byEventPath.emplace(key, &entry);
+        }
+    }
     return 1;
 }
 
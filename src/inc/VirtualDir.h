@@ -15,6 +15,11 @@ struct VirtualDirCallbacks
      *  should return 0 on success or -1 on an error. */
     VDCallback_GetInfo get_info;
 
+    /** Variant of \b get_info which gets a reference to the request
+     *  headers instead of a copy in the File_Info structure. Used
+     *  instead of get_info if set. */
+    VDCallback_GetInfo2 get_info2;
+
     /** Called by the web server to open a file.  The callback should return
      *  a valid handle if the file can be opened.  Otherwise, it should return
      *  \c NULL to signify an error. */
@@ -31,6 +36,11 @@ struct VirtualDirCallbacks
      */
     VDCallback_Read read;
 
+    /** Asynchronous version of the read callback. If this is set, it is
+     *  used instead of \b read, and may return UPNP_E_WOULD_BLOCK. See
+     *  upnp.h for details. */
+    VDCallback_ReadAsync read_async;
+
     /** Called by the web server to perform a sequential write to an open
      *  file.  The callback should write \b buflen bytes into the file from
      *  the buffer.  It should return the actual number of bytes written, 
@@ -164,16 +164,27 @@ typedef intptr_t ssize_t;
 
 /*! \name MAX_SUBSCRIPTION_QUEUED_EVENTS
  *
- *  The {\tt MAX_SUBSCRIPTION_QUEUED_EVENTS} determines the maximum number of
- *  events which can be queued for a given subscription before events begin
- *  to be discarded. This limits the amount of memory used for a
- *  non-responding subscribed entity.
+ *  The {\tt MAX_SUBSCRIPTION_QUEUED_EVENTS} determines the capacity of the
+ *  event ring of a subscription. New events are merged into the last
+ *  pending one when possible, so this is rarely reached.
  *
  * @{
  */
 #define MAX_SUBSCRIPTION_QUEUED_EVENTS 10
 /* @} */
 
+/*! \name MAX_SUBSCRIPTION_QUEUED_BYTES
+ *
+ *  The {\tt MAX_SUBSCRIPTION_QUEUED_BYTES} determines the maximum total
+ *  size of the events waiting to be sent to a given subscription
+ *  before events begin to be discarded. This limits the amount of
+ *  memory used for a non-responding subscribed entity.
+ *
+ * @{
+ */
+#define MAX_SUBSCRIPTION_QUEUED_BYTES (256 * 1024)
+/* @} */
+
 
 /*! \name MAX_SUBSCRIPTION_EVENT_AGE
  *
@@ -181,7 +192,7 @@ typedef intptr_t ssize_t;
  *  seconds which an event can spend on a subscription queue (waiting for the 
  *  event at the head of the queue to be communicated). This parameter will 
  *  have no effect in most situations with the default (low) value of 
- *  MAX_SUBSCRIPTION_QUEUED_EVENTS. However, if MAX_SUBSCRIPTION_QUEUED_EVENTS 
+ *  MAX_SUBSCRIPTION_QUEUED_BYTES. However, if MAX_SUBSCRIPTION_QUEUED_BYTES 
  *  is set to a high value, the AGE parameter will allow pruning the queue in 
  *  good conformance with the UPnP Device Architecture standard, at the 
  *  price of higher potential memory use.
@@ -246,6 +257,50 @@ typedef intptr_t ssize_t;
 #define WEB_SERVER_CONTENT_LANGUAGE ""
 /* @} */
 
+/*!
+ * \name WEB_SERVER_FILE_CACHE
+ *
+ * The web server keeps a cache for the files served from the document root
+ * directory. Files smaller than {\tt WEB_SERVER_FILE_CACHE_MAX_FILE_SIZE}
+ * bytes are kept in memory, up to {\tt WEB_SERVER_FILE_CACHE_MAX_BYTES} in
+ * total. Bigger files are kept open, up to {\tt WEB_SERVER_FD_CACHE_SIZE}
+ * descriptors. Entries are used without checking the file system for {\tt
+ * WEB_SERVER_FILE_CACHE_TTL} seconds, and are then validated by comparing the
+ * file size and modification time. Set WEB_SERVER_FILE_CACHE_TTL to 0 to
+ * disable the cache.
+ *
+ * @{
+ */
+#define WEB_SERVER_FILE_CACHE_TTL 5
+#define WEB_SERVER_FILE_CACHE_MAX_FILE_SIZE (64 * 1024)
+#define WEB_SERVER_FILE_CACHE_MAX_BYTES (4 * 1024 * 1024)
+#define WEB_SERVER_FD_CACHE_SIZE 32
+/* @} */
+
+/*!
+ * \name WEB_SERVER_INFO_CACHE_SIZE
+ *
+ * Maximum number of virtual directory GetInfo results kept by the web server,
+ * when the application allows caching them by setting File_Info::cache_ttl.
+ *
+ * @{
+ */
+#define WEB_SERVER_INFO_CACHE_SIZE 256
+/* @} */
+
+/*!
+ * \name WEB_SERVER_RATE_LIMIT_MIN_SIZE
+ *
+ * When bandwidth limits are set with UpnpSetWebServerRateLimits(), web server
+ * transfers smaller than this (e.g. description documents, icons) are not
+ * subjected to them, so that they stay responsive while streams are
+ * running.
+ *
+ * @{
+ */
+#define WEB_SERVER_RATE_LIMIT_MIN_SIZE (128 * 1024)
+/* @} */
+
 /*!
  * \name AUTO_RENEW_TIME
  *
@@ -350,6 +405,64 @@ typedef intptr_t ssize_t;
 /* @} */
 
 
+/*!
+ * \name GENA_NOTIFY_CONNECTION_CACHE_SIZE
+ *
+ * The GENA notifications are all sent by a single thread, which keeps
+ * the connections to the Control Points open for reuse by the next
+ * events. This is the maximum number of idle connections kept.
+ *
+ * @{
+ */
+#define GENA_NOTIFY_CONNECTION_CACHE_SIZE 64
+/* @} */
+
+/*!
+ * \name GENA_CP_MAX_PARALLEL_SUBSCRIPTIONS
+ *
+ * The asynchronous subscription operations of a Control Point
+ * (UpnpSubscribeAsync() and the others) are performed by a single
+ * thread. This is the maximum number of requests in progress at the
+ * same time, the others wait in a queue.
+ *
+ * @{
+ */
+#define GENA_CP_MAX_PARALLEL_SUBSCRIPTIONS 16
+/* @} */
+
+
+/*!
+ * \name GENA_NOTIFY_FAILURES_BEFORE_BACKOFF
+ *
+ * After this number of consecutive failed deliveries to a subscriber
+ * (e.g. a Control Point which left the network without unsubscribing),
+ * the library stops sending it events for a while instead of paying a
+ * full timeout for each of them. The events are merged in the meantime,
+ * and the latest state is sent when the delivery is retried. The delay
+ * starts at GENA_NOTIFY_BACKOFF_MIN seconds and doubles after each new
+ * failure, up to GENA_NOTIFY_BACKOFF_MAX.
+ *
+ * @{
+ */
+#define GENA_NOTIFY_FAILURES_BEFORE_BACKOFF 3
+#define GENA_NOTIFY_BACKOFF_MIN 5
+#define GENA_NOTIFY_BACKOFF_MAX 300
+/* @} */
+
+
+/*!
+ * \name GENA_MCAST_MAX_PACKET
+ *
+ * Maximum size for a UDA 2.0 multicast event datagram, so that it fits
+ * in a single Ethernet frame. Bigger events are only sent to the
+ * subscribers.
+ *
+ * @{
+ */
+#define GENA_MCAST_MAX_PACKET 1472
+/* @} */
+
+
    
 /*!
  * \name Other debugging features
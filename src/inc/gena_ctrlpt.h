@@ -34,6 +34,7 @@
 
 #include <mutex>
 #include <string>
+#include <unordered_map>
 
 #include "upnp.h"
 
@@ -56,6 +57,14 @@ struct ClientSubscription {
     }
 };
 
+/* The client subscriptions, indexed by SID. The table has its own
+   mutex, so that the lookup for each incoming event only needs the
+   shared handle lock. The mutex is taken after the handle lock. */
+struct ClientSubscriptionTable {
+    std::mutex mutex;
+    std::unordered_map<std::string, ClientSubscription> bySid;
+};
+
 extern std::mutex GlobalClientSubscribeMutex;
 
 struct MHDTransaction;
@@ -63,6 +72,12 @@ struct MHDTransaction;
 /** Processes NOTIFY events that are sent by devices. */
 void gena_process_notification_event(MHDTransaction *);
 
+#ifdef INCLUDE_CLIENT_APIS
+/** Processes a UDA 2.0 multicast event datagram. */
+void gena_process_multicast_event(
+    const char *packet, size_t len, const struct sockaddr_storage *from);
+#endif /* INCLUDE_CLIENT_APIS */
+
 /*!
  * \brief This function subscribes to a PublisherURL (also mentioned as EventURL
  * in some places).
@@ -135,6 +150,75 @@ extern int genaRenewSubscription(
     /*! [in,out] requested Duration, if -1, then "infinite". In the OUT case:
      * actual Duration granted by Service, -1 for infinite. */
     int *TimeOut);
+
+/*!
+ * \brief Starts the thread which performs the asynchronous subscription
+ * operations.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_INIT_FAILED.
+ */
+int genaSubsOpsEngineStart();
+
+/*!
+ * \brief Stops the asynchronous subscription operations thread. Pending
+ * operations are discarded.
+ */
+void genaSubsOpsEngineStop();
+
+/*!
+ * \brief Queues a subscription request. The result is passed to the
+ * callback with UPNP_EVENT_SUBSCRIBE_COMPLETE.
+ *
+ * \return UPNP_E_SUCCESS if the request was queued, otherwise the
+ *     appropriate error code.
+ */
+int genaSubscribeAsync(
+    /*! [in] The client handle. */
+    UpnpClient_Handle client_handle,
+    /*! [in] The event URL of the service. */
+    const std::string& PublisherURL,
+    /*! [in] Requested duration, -1 for "infinite". */
+    int TimeOut,
+    /*! [in] Completion callback, the handle's if null. */
+    Upnp_FunPtr callback,
+    /*! [in] Cookie for the completion callback. */
+    const void *cookie);
+
+/*!
+ * \brief Queues a subscription renewal. The result is passed to the
+ * callback with UPNP_EVENT_RENEWAL_COMPLETE.
+ *
+ * \return UPNP_E_SUCCESS if the request was queued, otherwise the
+ *     appropriate error code.
+ */
+int genaRenewSubscriptionAsync(
+    /*! [in] The client handle. */
+    UpnpClient_Handle client_handle,
+    /*! [in] Subscription ID. */
+    const std::string& in_sid,
+    /*! [in] Requested duration, -1 for "infinite". */
+    int TimeOut,
+    /*! [in] Completion callback, the handle's if null. */
+    Upnp_FunPtr callback,
+    /*! [in] Cookie for the completion callback. */
+    const void *cookie);
+
+/*!
+ * \brief Queues an unsubscription request. The result is passed to the
+ * callback with UPNP_EVENT_UNSUBSCRIBE_COMPLETE.
+ *
+ * \return UPNP_E_SUCCESS if the request was queued, otherwise the
+ *     appropriate error code.
+ */
+int genaUnSubscribeAsync(
+    /*! [in] The client handle. */
+    UpnpClient_Handle client_handle,
+    /*! [in] Subscription ID. */
+    const std::string& in_sid,
+    /*! [in] Completion callback, the handle's if null. */
+    Upnp_FunPtr callback,
+    /*! [in] Cookie for the completion callback. */
+    const void *cookie);
 #endif /* INCLUDE_CLIENT_APIS */
 
 #endif /* GENA_CTRLPT_H */
@@ -33,6 +33,41 @@
 #define GENA_DEVICE_H
 
 #ifdef INCLUDE_DEVICE_APIS
+/*!
+ * \brief Starts the thread which sends the event notifications.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_INIT_FAILED.
+ */
+int genaNotifyEngineStart();
+
+/*!
+ * \brief Stops the notification thread. Pending notifications are discarded.
+ */
+void genaNotifyEngineStop();
+
+/*!
+ * \brief Retrieves the subscription counts and expiry statistics for a
+ * device handle.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_INVALID_HANDLE.
+ */
+int genaGetSubscriptionStats(
+    /*! [in] Device handle. */
+    UpnpDevice_Handle device_handle,
+    /*! [out] Statistics. */
+    UpnpSubscriptionStats& stats);
+
+/*!
+ * \brief Restores the subscriptions saved for a root device when it was
+ * last unregistered, if the subscriptions file option is set and the
+ * CONFIGID did not change. Called with the handle lock held.
+ *
+ * \return The number of restored subscriptions.
+ */
+int genaRestoreSubscriptions(
+    /*! [in] Handle information for the newly registered device. */
+    struct Handle_Info *handle_info);
+
 /*!
  * \brief Cleans the service table of the device.
  *
@@ -70,7 +105,77 @@ int genaNotifyAllXML(
     char* UDN,
     /*! [in] Service ID. */
     char* servId,
-    const std::string& propertySet);
+    /*! [in] Property set document. Shared by all the notifications. */
+    std::string propertySet);
+
+/*!
+ * \brief Sends events for several services of a device, with a single
+ * lock acquisition and a single submission to the sending engine.
+ *
+ * \return UPNP_E_SUCCESS or an error code.
+ */
+int genaNotifyBatch(
+    /*! [in] Device handle. */
+    UpnpDevice_Handle device_handle,
+    /*! [in] The events. */
+    const std::vector<UpnpNotifyBatchEntry>& entries);
+
+/*!
+ * \brief Updates the library-managed state for a service, and sends an
+ * event with the changed variables, subject to their moderation.
+ *
+ * \return UPNP_E_SUCCESS or an error code.
+ */
+int genaSetStateVariables(
+    /*! [in] Device handle. */
+    UpnpDevice_Handle device_handle,
+    /*! [in] Device udn. */
+    const char *UDN,
+    /*! [in] Service ID. */
+    const char *servId,
+    /*! [in] Array of variable names. */
+    const char **names,
+    /*! [in] Array of variable values. */
+    const char **values,
+    /*! [in] Number of variables. */
+    int count);
+
+/*!
+ * \brief Sets the event moderation parameters for a state variable.
+ *
+ * \return UPNP_E_SUCCESS or an error code.
+ */
+int genaSetStateVariableModeration(
+    /*! [in] Device handle. */
+    UpnpDevice_Handle device_handle,
+    /*! [in] Device udn. */
+    const char *UDN,
+    /*! [in] Service ID. */
+    const char *servId,
+    /*! [in] Variable name. */
+    const char *name,
+    /*! [in] Minimum interval between events in milliseconds, 0 for none. */
+    int maxRateMs,
+    /*! [in] Minimum change for a numeric value to be evented, 0 for none. */
+    double minDelta);
+
+/*!
+ * \brief Sets the variables of a service which are also sent as UDA 2.0
+ * multicast events.
+ *
+ * \return UPNP_E_SUCCESS or an error code.
+ */
+int genaSetMulticastEventing(
+    /*! [in] Device handle. */
+    UpnpDevice_Handle device_handle,
+    /*! [in] Device udn. */
+    const char *UDN,
+    /*! [in] Service ID. */
+    const char *servId,
+    /*! [in] Variable names. Empty to disable multicast eventing. */
+    const std::vector<std::string>& names,
+    /*! [in] Event level (LVL header). nullptr for upnp:/general. */
+    const char *level);
 
 /*!
  * \brief Sends the intial state table dump to newly subscribed control point.
@@ -34,6 +34,7 @@
 #define _HTTPUTILS_H_
 
 #include <cstddef>
+#include <chrono>
 #include <ctime>
 #include <map>
 #include <string>
@@ -82,7 +83,13 @@ public:
     std::string postdata;
     /* Set by callback */
     struct MHD_Response *response{nullptr};
-    int httpstatus;
+    int httpstatus{0};
+    /* Response body size if known, else -1. Used for the access log. */
+    int64_t respsize{-1};
+    /* Access log timing, set only if the log is enabled */
+    bool logged{false};
+    std::chrono::steady_clock::time_point starttime;
+    std::chrono::steady_clock::time_point queuedtime;
 
     void copyClientAddress(struct sockaddr_storage *dest) const;
     void copyToClientAddress(const struct sockaddr *src);
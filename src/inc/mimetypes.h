@@ -0,0 +1,226 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2026 J.F. Dockes
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * - Neither name of Intel Corporation nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#ifndef _MIMETYPES_H_INCLUDED_
+#define _MIMETYPES_H_INCLUDED_
+
+/* File name extension to MIME type table, used by the web server to
+   set the Content-Type of files from the document root.
+
+   The lookup uses a perfect hash table computed at compile time: the
+   seed for the hash function is chosen so that all the extensions
+   land in distinct slots. A lookup is one hash computation over the
+   extension, one table access and one case-insensitive comparison,
+   with no allocation. */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace mimetypes {
+
+struct MimeEntry {
+    std::string_view ext;
+    std::string_view type;
+};
+
+/* Extensions must be lowercase. */
+inline constexpr MimeEntry gMimeEntries[] = {
+    {"aif", "audio/aiff"},
+    {"aifc", "audio/aiff"},
+    {"aiff", "audio/aiff"},
+    {"asf", "video/x-ms-asf"},
+    {"asx", "video/x-ms-asf"},
+    {"au", "audio/basic"},
+    {"avi", "video/msvideo"},
+    {"bmp", "image/bmp"},
+    {"css", "text/css"},
+    {"dcr", "application/x-director"},
+    {"dib", "image/bmp"},
+    {"dir", "application/x-director"},
+    {"dxr", "application/x-director"},
+    {"gif", "image/gif"},
+    {"hta", "text/hta"},
+    {"htm", "text/html"},
+    {"html", "text/html"},
+    {"jar", "application/java-archive"},
+    {"jfif", "image/pjpeg"},
+    {"jpe", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"jpg", "image/jpeg"},
+    {"js", "application/x-javascript"},
+    {"kar", "audio/midi"},
+    {"m3u", "audio/mpegurl"},
+    {"mid", "audio/midi"},
+    {"midi", "audio/midi"},
+    {"mov", "video/quicktime"},
+    {"mp2v", "video/x-mpeg2"},
+    {"mp3", "audio/mpeg"},
+    {"mpe", "video/mpeg"},
+    {"mpeg", "video/mpeg"},
+    {"mpg", "video/mpeg"},
+    {"mpv", "video/mpeg"},
+    {"mpv2", "video/x-mpeg2"},
+    {"pdf", "application/pdf"},
+    {"pjp", "image/jpeg"},
+    {"pjpeg", "image/jpeg"},
+    {"plg", "text/html"},
+    {"pls", "audio/scpls"},
+    {"png", "image/png"},
+    {"qt", "video/quicktime"},
+    {"ram", "audio/x-pn-realaudio"},
+    {"rmi", "audio/mid"},
+    {"rmm", "audio/x-pn-realaudio"},
+    {"rtf", "application/rtf"},
+    {"shtml", "text/html"},
+    {"smf", "audio/midi"},
+    {"snd", "audio/basic"},
+    {"spl", "application/futuresplash"},
+    {"ssm", "application/streamingmedia"},
+    {"swf", "application/x-shockwave-flash"},
+    {"tar", "application/tar"},
+    {"tcl", "application/x-tcl"},
+    {"text", "text/plain"},
+    {"tif", "image/tiff"},
+    {"tiff", "image/tiff"},
+    {"txt", "text/plain"},
+    {"ulw", "audio/basic"},
+    {"wav", "audio/wav"},
+    {"wax", "audio/x-ms-wax"},
+    {"wm", "video/x-ms-wm"},
+    {"wma", "audio/x-ms-wma"},
+    {"wmv", "video/x-ms-wmv"},
+    {"wvx", "video/x-ms-wvx"},
+    {"xbm", "image/x-xbitmap"},
+    {"xml", "text/xml"},
+    {"xsl", "text/xml"},
+    {"z", "application/x-compress"},
+    {"zip", "application/zip"}
+};
+
+inline constexpr size_t gMimeEntriesCount = sizeof(gMimeEntries) / sizeof(gMimeEntries[0]);
+
+/* Table size: a power of 2, big enough relative to the entry count
+   that a suitable seed is found quickly. */
+inline constexpr size_t gMimeTableSize = 512;
+/* Empty slot marker */
+inline constexpr uint8_t gMimeNoEntry = 0xff;
+static_assert(gMimeEntriesCount < gMimeNoEntry, "Too many MIME entries for uint8_t index");
+
+constexpr char asciitolower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+constexpr size_t maxExtLength()
+{
+    size_t mx = 0;
+    for (const auto& entry : gMimeEntries) {
+        if (entry.ext.size() > mx)
+            mx = entry.ext.size();
+    }
+    return mx;
+}
+inline constexpr size_t gMimeMaxExtLength = maxExtLength();
+
+/* FNV-1a over the lowercased characters, perturbed by the seed */
+constexpr uint32_t exthash(std::string_view ext, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (char c : ext) {
+        h ^= static_cast<unsigned char>(asciitolower(c));
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+constexpr size_t extslot(std::string_view ext, uint32_t seed)
+{
+    return exthash(ext, seed) & (gMimeTableSize - 1);
+}
+
+constexpr bool seedIsPerfect(uint32_t seed)
+{
+    std::array<bool, gMimeTableSize> used{};
+    for (const auto& entry : gMimeEntries) {
+        auto slot = extslot(entry.ext, seed);
+        if (used[slot])
+            return false;
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t findSeed()
+{
+    for (uint32_t seed = 0; seed < 100000; seed++) {
+        if (seedIsPerfect(seed))
+            return seed;
+    }
+    return UINT32_MAX;
+}
+inline constexpr uint32_t gMimeSeed = findSeed();
+static_assert(gMimeSeed != UINT32_MAX, "No perfect hash seed found for the MIME table");
+
+constexpr std::array<uint8_t, gMimeTableSize> buildTable()
+{
+    std::array<uint8_t, gMimeTableSize> table{};
+    for (auto& e : table)
+        e = gMimeNoEntry;
+    for (size_t i = 0; i < gMimeEntriesCount; i++) {
+        table[extslot(gMimeEntries[i].ext, gMimeSeed)] = static_cast<uint8_t>(i);
+    }
+    return table;
+}
+inline constexpr std::array<uint8_t, gMimeTableSize> gMimeTable = buildTable();
+
+/** Return the MIME type for a file name extension (without the dot),
+ *  compared case-insensitively, or an empty string_view if not found. */
+constexpr std::string_view mimetype_for_ext(std::string_view ext)
+{
+    if (ext.empty() || ext.size() > gMimeMaxExtLength)
+        return {};
+    auto idx = gMimeTable[extslot(ext, gMimeSeed)];
+    if (idx == gMimeNoEntry)
+        return {};
+    const auto& entry = gMimeEntries[idx];
+    if (entry.ext.size() != ext.size())
+        return {};
+    for (size_t i = 0; i < ext.size(); i++) {
+        if (asciitolower(ext[i]) != entry.ext[i])
+            return {};
+    }
+    return entry.type;
+}
+
+} // namespace mimetypes
+
+#endif /* _MIMETYPES_H_INCLUDED_ */
@@ -37,6 +37,7 @@
 #include <cstdint>
 
 #include "httputils.h"
+#include "upnp.h"
 #include "upnpinet.h"
 #include <vector>
 
@@ -61,6 +62,9 @@ struct MiniServerSockArray {
     std::vector<SOCKET> ssdpReqSock6List {};
 #endif /* UPNP_ENABLE_IPV6 */
 
+    /*! Sockets for receiving the UDA 2.0 multicast events */
+    SOCKET eventSock4{INVALID_SOCKET};
+    SOCKET eventSock6{INVALID_SOCKET};
 #endif /* INCLUDE_CLIENT_APIS */
 
     MiniServerSockArray() = default;
@@ -70,6 +74,8 @@ struct MiniServerSockArray {
         maybeClose(ssdpSock6);
         maybeClose(ssdpSock6UlaGua);
 #ifdef INCLUDE_CLIENT_APIS
+        maybeClose(eventSock4);
+        maybeClose(eventSock6);
         for (SOCKET socket: ssdpReqSock4List) {
             maybeClose(socket);
         }
@@ -150,6 +156,16 @@ int StartMiniServer(
  */
 int StopMiniServer();
 
+/*!
+ * \brief Set the access log capacity (0 to disable). See UpnpSetAccessLog().
+ */
+int SetMiniServerAccessLog(size_t capacity);
+
+/*!
+ * \brief Retrieve the access log entries. See UpnpDrainAccessLog().
+ */
+int DrainMiniServerAccessLog(std::vector<UpnpAccessLogEntry>& entries, uint64_t *dropped);
+
 // Retrieve the sockets arrays used for CP SSDP search requests
 std::vector<SOCKET>& miniServerGetReqSocks4();
 std::vector<SOCKET>& miniServerGetReqSocks6();
@@ -0,0 +1,329 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2026 J.F. Dockes
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * - Neither name of Intel Corporation nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#ifndef _PROPSETPARSE_H_INCLUDED_
+#define _PROPSETPARSE_H_INCLUDED_
+
+/* Fast GENA property set parser, working in place in the request buffer.
+
+   The names and values are returned as views into the buffer, and the
+   values are decoded in place (a decoded reference is never longer
+   than its source). Only the usual layout is accepted: elements with
+   text content inside property elements. Anything else (CDATA,
+   comments or nested elements in the values, unknown or invalid
+   references) makes it return false without modifying the buffer, and
+   the caller then uses the XML parser. The output is the same as the
+   XML parser's for the documents which are accepted. */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace propsetparse {
+
+using PropertyViews = std::vector<std::pair<std::string_view, std::string_view>>;
+
+/* The Char production from the XML 1.0 spec */
+inline bool isXMLChar(unsigned long cp)
+{
+    return cp == 0x9 || cp == 0xA || cp == 0xD || (cp >= 0x20 && cp <= 0xD7FF) ||
+        (cp >= 0xE000 && cp <= 0xFFFD) || (cp >= 0x10000 && cp <= 0x10FFFF);
+}
+
+/* Value of a numeric character reference (the part between "&#" and
+   ";"), or 0 if it is malformed or not an XML Char. */
+inline unsigned long charRefValue(std::string_view ref)
+{
+    bool hex = !ref.empty() && ref[0] == 'x';
+    if (hex)
+        ref.remove_prefix(1);
+    if (ref.empty())
+        return 0;
+    unsigned long cp = 0;
+    for (char d : ref) {
+        unsigned long v;
+        if (d >= '0' && d <= '9') {
+            v = d - '0';
+        } else if (hex && d >= 'a' && d <= 'f') {
+            v = d - 'a' + 10;
+        } else if (hex && d >= 'A' && d <= 'F') {
+            v = d - 'A' + 10;
+        } else {
+            return 0;
+        }
+        cp = cp * (hex ? 16 : 10) + v;
+        if (cp > 0x10FFFF)
+            return 0;
+    }
+    return isXMLChar(cp) ? cp : 0;
+}
+
+/* Position of the next c in s at or after from, or len */
+inline size_t findChar(const char *s, size_t len, size_t from, char c)
+{
+    auto p = static_cast<const char*>(memchr(s + from, c, len - from));
+    return p ? p - s : len;
+}
+
+/* Decode the references in a value and normalize the line ends (CR
+   and CRLF become LF). If write is false, only check that the
+   references are valid. Returns the decoded size, or npos for an
+   unknown or bad reference. */
+inline size_t decodeValue(char *s, size_t len, bool write)
+{
+    size_t nextamp = findChar(s, len, 0, '&');
+    size_t nextcr = findChar(s, len, 0, '\r');
+    size_t in = std::min(nextamp, nextcr);
+    size_t out = in;
+    while (in < len) {
+        if (nextamp < in)
+            nextamp = findChar(s, len, in, '&');
+        if (nextcr < in)
+            nextcr = findChar(s, len, in, '\r');
+        if (size_t run = std::min(nextamp, nextcr) - in; run > 0) {
+            // Copy the run up to the next reference or CR
+            if (write)
+                memmove(s + out, s + in, run);
+            out += run;
+            in += run;
+            continue;
+        }
+        if (s[in] == '\r') {
+            if (write)
+                s[out] = '\n';
+            out++;
+            in++;
+            if (in < len && s[in] == '\n')
+                in++;
+            continue;
+        }
+        std::string_view rest(s + in + 1, len - in - 1);
+        auto semi = rest.find(';');
+        if (semi == std::string_view::npos) {
+            return std::string::npos;
+        }
+        auto ref = rest.substr(0, semi);
+        char c = 0;
+        if (ref == "lt") {
+            c = '<';
+        } else if (ref == "gt") {
+            c = '>';
+        } else if (ref == "amp") {
+            c = '&';
+        } else if (ref == "quot") {
+            c = '"';
+        } else if (ref == "apos") {
+            c = '\'';
+        }
+        if (c) {
+            if (write)
+                s[out] = c;
+            out++;
+        } else {
+            // Numeric character reference, encoded as UTF-8
+            if (ref.empty() || ref[0] != '#') {
+                return std::string::npos;
+            }
+            unsigned long cp = charRefValue(ref.substr(1));
+            if (cp == 0) {
+                return std::string::npos;
+            }
+            char utf8[4];
+            int n;
+            if (cp < 0x80) {
+                utf8[0] = static_cast<char>(cp);
+                n = 1;
+            } else if (cp < 0x800) {
+                utf8[0] = static_cast<char>(0xC0 | (cp >> 6));
+                utf8[1] = static_cast<char>(0x80 | (cp & 0x3F));
+                n = 2;
+            } else if (cp < 0x10000) {
+                utf8[0] = static_cast<char>(0xE0 | (cp >> 12));
+                utf8[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                utf8[2] = static_cast<char>(0x80 | (cp & 0x3F));
+                n = 3;
+            } else {
+                utf8[0] = static_cast<char>(0xF0 | (cp >> 18));
+                utf8[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                utf8[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                utf8[3] = static_cast<char>(0x80 | (cp & 0x3F));
+                n = 4;
+            }
+            if (write)
+                memcpy(s + out, utf8, n);
+            out += n;
+        }
+        in += semi + 2;
+    }
+    return out;
+}
+
+inline bool isXMLSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* Skip white space, and the XML declaration or processing instructions */
+inline void skipMisc(const std::string& xml, size_t& pos)
+{
+    for (;;) {
+        while (pos < xml.size() && isXMLSpace(xml[pos]))
+            pos++;
+        if (xml.compare(pos, 2, "<?") != 0)
+            return;
+        pos = xml.find("?>", pos);
+        if (pos == std::string::npos) {
+            pos = xml.size();
+            return;
+        }
+        pos += 2;
+    }
+}
+
+struct XMLTag {
+    std::string_view name;
+    bool closing{false};
+    bool empty{false};
+};
+
+/* Read the tag at pos, which must be at a '<'. Attribute values are
+   skipped, a '>' inside one does not end the tag. */
+inline bool readTag(const std::string& xml, size_t& pos, XMLTag& tag)
+{
+    if (pos >= xml.size() || xml[pos] != '<' || xml.compare(pos, 2, "<!") == 0)
+        return false;
+    auto end = xml.find_first_of(">\"'", pos);
+    while (end != std::string::npos && xml[end] != '>') {
+        auto close = xml.find(xml[end], end + 1);
+        if (close == std::string::npos || xml.find('<', end) < close)
+            return false;
+        end = xml.find_first_of(">\"'", close + 1);
+    }
+    if (end == std::string::npos)
+        return false;
+    size_t start = pos + 1;
+    tag.closing = xml[start] == '/';
+    if (tag.closing)
+        start++;
+    tag.empty = !tag.closing && xml[end - 1] == '/';
+    size_t nend = start;
+    while (nend < end && !isXMLSpace(xml[nend]) && xml[nend] != '/')
+        nend++;
+    tag.name = std::string_view(xml.data() + start, nend - start);
+    pos = end + 1;
+    return !tag.name.empty();
+}
+
+inline bool localNameIs(std::string_view name, std::string_view ref)
+{
+    auto colon = name.find(':');
+    if (colon != std::string_view::npos)
+        name.remove_prefix(colon + 1);
+    return name == ref;
+}
+
+/* Parse a property set. The variables are appended to vars, with views
+   into xml, which is only modified if true is returned. */
+inline bool parseInPlace(std::string& xml, PropertyViews& vars)
+{
+    size_t pos = 0;
+    XMLTag top, prop, tag;
+    skipMisc(xml, pos);
+    if (!readTag(xml, pos, top) || top.closing || top.empty || !localNameIs(top.name, "propertyset"))
+        return false;
+    for (;;) {
+        skipMisc(xml, pos);
+        if (!readTag(xml, pos, prop))
+            return false;
+        if (prop.closing) {
+            if (prop.name != top.name)
+                return false;
+            break;
+        }
+        if (!localNameIs(prop.name, "property"))
+            return false;
+        if (prop.empty)
+            continue;
+        // One or more variables, then </property>
+        for (;;) {
+            skipMisc(xml, pos);
+            XMLTag var;
+            if (!readTag(xml, pos, var))
+                return false;
+            if (var.closing) {
+                if (var.name != prop.name)
+                    return false;
+                break;
+            }
+            if (var.empty) {
+                vars.emplace_back(var.name, std::string_view());
+                continue;
+            }
+            auto end = xml.find('<', pos);
+            if (end == std::string::npos)
+                return false;
+            size_t start = pos;
+            pos = end;
+            if (!readTag(xml, pos, tag) || !tag.closing || tag.name != var.name)
+                return false;
+            if (decodeValue(xml.data() + start, end - start, false) == std::string::npos)
+                return false;
+            // The raw value, decoded when the whole document is accepted
+            vars.emplace_back(var.name, std::string_view(xml.data() + start, end - start));
+        }
+    }
+    // Nothing but white space or processing instructions after the end
+    skipMisc(xml, pos);
+    if (pos != xml.size())
+        return false;
+    for (auto& var : vars) {
+        if (var.second.empty())
+            continue;
+        char *value = xml.data() + (var.second.data() - xml.data());
+        size_t len = decodeValue(value, var.second.size(), true);
+        // Same trimming as the XML parser
+        while (len > 0 && isXMLSpace(value[len - 1]))
+            len--;
+        while (len > 0 && isXMLSpace(*value)) {
+            value++;
+            len--;
+        }
+        var.second = std::string_view(value, len);
+    }
+    return true;
+}
+
+} // namespace propsetparse
+
+#endif /* _PROPSETPARSE_H_INCLUDED_ */
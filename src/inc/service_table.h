@@ -33,9 +33,16 @@
 #ifndef SERVICE_TABLE_H
 #define SERVICE_TABLE_H
 
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <ctime>
 #include <list>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <memory>
 
@@ -49,17 +56,102 @@
 #ifdef INCLUDE_DEVICE_APIS
 
 struct Notification;
+/* Immutable delivery data, see gena_device.cpp */
+struct DeliveryTarget;
+
+/* Fixed capacity ring of the events queued for a subscription. */
+class NotificationQueue {
+public:
+    static constexpr size_t capacity = MAX_SUBSCRIPTION_QUEUED_EVENTS;
+    bool empty() const {
+        return m_count == 0;
+    }
+    bool full() const {
+        return m_count == capacity;
+    }
+    size_t size() const {
+        return m_count;
+    }
+    /* Index 0 is the oldest element */
+    std::shared_ptr<Notification>& operator[](size_t i) {
+        return m_slots[(m_first + i) % capacity];
+    }
+    std::shared_ptr<Notification>& front() {
+        return (*this)[0];
+    }
+    std::shared_ptr<Notification>& back() {
+        return (*this)[m_count - 1];
+    }
+    /* The caller checks that the queue is not full */
+    void push_back(std::shared_ptr<Notification> n) {
+        m_slots[(m_first + m_count) % capacity] = std::move(n);
+        m_count++;
+    }
+    void pop_front() {
+        front().reset();
+        m_first = (m_first + 1) % capacity;
+        m_count--;
+    }
+    void erase(size_t i) {
+        if (i == 0) {
+            pop_front();
+            return;
+        }
+        for (; i + 1 < m_count; i++) {
+            (*this)[i] = std::move((*this)[i + 1]);
+        }
+        back().reset();
+        m_count--;
+    }
+private:
+    std::array<std::shared_ptr<Notification>, capacity> m_slots;
+    size_t m_first{0};
+    size_t m_count{0};
+};
+
 struct subscription {
     Upnp_SID sid; /* char[44] in upnp.h */
     int ToSendEventKey{0};
     time_t expireTime{0};
     int active{0};
-    std::vector<std::string> DeliveryURLs;
-    /* List of queued events for this subscription. Only one event job
-       at a time goes into the thread pool. The first element in the
-       list is a copy of the active job. Others are activated on job
-       completion. */
-    std::list<std::shared_ptr<Notification>> outgoing;
+    /* Delivery URLs and constant NOTIFY headers. Shared with the
+       transfers in progress, which hold it without copying. */
+    std::shared_ptr<const DeliveryTarget> delivery;
+    /* Queued events for this subscription. Only one event at a time
+       is being sent: the first element in the queue. Others are
+       activated on completion. Pending events are merged when
+       possible, see gena_device.cpp */
+    NotificationQueue outgoing;
+    /* Size of the pending (not being sent) property sets in the queue */
+    size_t outgoingBytes{0};
+    /* Delivery health. When suspendedUntil is not 0, the delivery is
+       suspended after repeated failures, and the head of the queue is
+       waiting for a retry instead of being sent. */
+    uint64_t delivered{0};
+    uint64_t failed{0};
+    int consecutiveFailures{0};
+    time_t lastSuccess{0};
+    int lastLatencyMs{-1};
+    time_t suspendedUntil{0};
+};
+
+/* State variable in the optional library-managed service state. See
+   genaSetStateVariables() in gena_device.cpp */
+struct StateVariable {
+    std::string name;
+    /* Current value, set by the application. Only meaningful if hasValue */
+    std::string value;
+    bool hasValue{false};
+    /* Last value sent in an event, if sent */
+    std::string sentValue;
+    bool sent{false};
+    std::chrono::steady_clock::time_point lastSent;
+    /* Changed, and not sent yet because of the moderation */
+    bool pending{false};
+    /* Moderation: minimum interval between events, and minimum change
+       for numeric values. 0 for none. */
+    int maxRateMs{0};
+    double minDelta{0};
 };
 
 struct service_info {
@@ -72,6 +164,26 @@ struct service_info {
     int        active{0};
     int        TotalSubscriptions{0};
     std::list<subscription>    subscriptionList;
+    /* Indexes on subscriptionList, kept in sync by AddSubscription,
+       SetSubscriptionExpiry and RemoveSubscriptionSID. Subscriptions
+       with an infinite timeout are not in the expiry index. */
+    std::unordered_map<std::string, std::list<subscription>::iterator> subscriptionsBySid;
+    std::set<std::pair<time_t, const subscription*>> subscriptionsByExpiry;
+    /* Expired subscriptions removed by the expiry timer, or found
+       expired when accessed (the timer had not run yet) */
+    uint64_t expiredByTimer{0};
+    uint64_t expiredOnAccess{0};
+    /* Library-managed state. When not empty, new subscriptions are
+       accepted automatically with the current values */
+    std::vector<StateVariable> stateVars;
+    /* Deadline of the earliest timer set to send the moderated
+       variables (zero if none) */
+    std::chrono::steady_clock::time_point stateFlushDeadline;
+    /* UDA 2.0 multicast eventing: the variables which are multicast,
+       the event level (LVL header), and the multicast SEQ counter */
+    std::vector<std::string> multicastVars;
+    std::string multicastLevel;
+    uint32_t multicastSeq{0};
 
     service_info() = default;
     ~service_info() = default;
@@ -79,18 +191,70 @@ struct service_info {
     service_info(const service_info& rhs) = delete;
 };
 
-using service_table =  std::list<service_info>;
+/* The services for a device handle (root and embedded devices), with
+   indexes on the (serviceId, UDN) pair and on the control and event URL
+   paths. The indexes are built by initServiceTable. */
+struct service_table {
+    std::list<service_info> services;
+    std::unordered_map<std::string, service_info*> byId;
+    std::unordered_map<std::string, service_info*> byControlPath;
+    std::unordered_map<std::string, service_info*> byEventPath;
+
+    std::list<service_info>::iterator begin() { return services.begin(); }
+    std::list<service_info>::iterator end() { return services.end(); }
+    std::list<service_info>::const_iterator begin() const { return services.begin(); }
+    std::list<service_info>::const_iterator end() const { return services.end(); }
+    bool empty() const { return services.empty(); }
+    void clear() {
+        byId.clear();
+        byControlPath.clear();
+        byEventPath.clear();
+        services.clear();
+    }
+};
+
+/*!
+ * \brief Compute the index key for a control or event URL (or request path):
+ * the URL path and query.
+ *
+ * \return false if the URL can't be parsed.
+ */
+bool servicePathKey(const std::string& url, std::string& key);
 
 /*!
- * \brief Makes a copy of the subscription.
+ * \brief Insert a new subscription in the service and index it by SID and
+ * expiration time. The subscription SID and expireTime must be set.
  *
- * \return UPNP_E_SUCCESS on success.
+ * \return Iterator to the subscription in the service list, or the list
+ *   end() if a subscription with the same SID exists.
  */
-int copy_subscription(
-    /*! [in] Source subscription. */
-    const subscription *in,
-    /*! [in] Destination subscription. */
-    subscription *out);
+std::list<subscription>::iterator AddSubscription(
+    /*! [in] Service object providing the list of subscriptions. */
+    service_info *service,
+    /*! [in] The new subscription. */
+    subscription&& sub);
+
+/*!
+ * \brief Change the expiration time for a subscription (renewal).
+ */
+void SetSubscriptionExpiry(
+    /*! [in] Service object providing the list of subscriptions. */
+    service_info *service,
+    /*! [in] Subscription from the service list. */
+    subscription *sub,
+    /*! [in] New expiration time, 0 for infinite. */
+    time_t expireTime);
+
+/*!
+ * \brief Remove the expired subscriptions from the service.
+ *
+ * \return The number of subscriptions removed.
+ */
+int ExpireSubscriptions(
+    /*! [in] Service object providing the list of subscriptions. */
+    service_info *service,
+    /*! [in] Current time. */
+    time_t now);
 
 /*
  * \brief Remove the subscription represented by the const Upnp_SID sid parameter
@@ -116,6 +280,7 @@ subscription *GetSubscriptionSID(
 
 /*!
  * \brief Gets pointer to the first subscription node in the service table.
+ * Expired subscriptions are removed first.
  *
  * \return Pointer to the first subscription node.
  */
@@ -124,7 +289,7 @@ std::list<subscription>::iterator GetFirstSubscription(
     service_info *service);
 
 /*!
- * \brief Get current and valid subscription from the service table.
+ * \brief Get the next active subscription from the service table.
  *
  * \return Pointer to the next subscription node.
  */
@@ -134,7 +299,7 @@ std::list<subscription>::iterator GetNextSubscription(
     bool getfirst = false);
 
 /*!
- * \brief Traverses through the service table and returns a pointer to the
+ * \brief Looks up the service table index and returns a pointer to the
  * service node that matches a known service id and a known UDN.
  *
  * \return Pointer to the matching service_info node.
@@ -150,7 +315,7 @@ service_info *FindServiceId(
     const std::string& UDN);
 
 /*!
- * \brief Traverses the service table and finds the node whose event URL Path
+ * \brief Looks up the service table index to find the node whose event URL Path
  * matches a know value.
  *
  * \return Pointer to the service list node from the service table whose event
@@ -163,7 +328,7 @@ service_info *FindServiceEventURLPath(
     const std::string& eventURLPath);
 
 /*!
- * \brief Traverses the service table and finds the node whose control URL Path
+ * \brief Looks up the service table index to find the node whose control URL Path
  * matches a know value.
  *
  * \return Pointer to the service list node from the service table whose control
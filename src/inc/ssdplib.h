@@ -47,6 +47,11 @@
 #define SSDP_IPV6_SITELOCAL "FF05::C"
 #define SSDP_PORT 1900
 
+/* UDA 2.0 multicast eventing */
+#define GENA_MCAST_IP   "239.255.255.246"
+#define GENA_MCAST_IPV6_LINKLOCAL "FF02::130"
+#define GENA_MCAST_PORT 7900
+
 /*! can be overwritten by configure CFLAGS argument. */
 #ifndef X_USER_AGENT
 /*! @name X_USER_AGENT
@@ -167,6 +172,14 @@ void readFromSSDPSocket(
     /* [in] SSDP socket. */
     SOCKET socket);
 
+/*!
+ * \brief Reads a multicast event datagram from the event socket and
+ * schedules its processing by the control point.
+ */
+void readFromEventSocket(
+    /* [in] Multicast event socket. */
+    SOCKET socket);
+
 /*!
  * \brief Creates the IPv4 and IPv6 ssdp sockets required by the
  *  control point and device operation.
@@ -246,6 +259,26 @@ void ssdp_handle_device_request(
     /* [in] . */
     struct sockaddr_storage *dest_addr);
 
+/*!
+ * \brief Sends a UDA 2.0 multicast event on all the interfaces.
+ *
+ * The request line, HOST and CONTENT-LENGTH headers are added to the
+ * other headers, which are supplied by the caller.
+ *
+ * \return UPNP_E_SUCCESS, or UPNP_E_NETWORK_ERROR if the event could not
+ * be sent on any interface.
+ */
+int ssdpSendMulticastEvent(
+    /* [in] Header lines, each terminated by CRLF. */
+    const std::string& headers,
+    /* [in] Property set. */
+    const std::string& body);
+
+/*!
+ * \brief Closes the sockets kept for the multicast events.
+ */
+void ssdpCloseMulticastEventSockets();
+
 #else /* INCLUDE_DEVICE_APIS */
 
 static inline void ssdp_handle_device_request(
@@ -38,6 +38,7 @@
 #include <list>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <vector>
 
@@ -59,7 +60,7 @@
 #define MAX_SOAP_CONTENT_LENGTH (size_t)32000
 
 extern size_t g_maxContentLength;
-extern int g_UpnpSdkEQMaxLen;
+extern size_t g_UpnpSdkEQMaxBytes;
 extern int g_UpnpSdkEQMaxAge;
 
 typedef enum {HND_INVALID=-1, HND_CLIENT, HND_DEVICE} Upnp_Handle_Type;
@@ -95,7 +96,7 @@ struct Handle_Info
     /*! Parsed Device Description document. */
     UPnPDeviceDesc devdesc;
     /*! Service information and subscriptions lists */
-    std::list<service_info> serviceTable;
+    service_table serviceTable;
     /*! . */
     int MaxSubscriptions{0};
     /*! . */
@@ -104,11 +105,15 @@ struct Handle_Info
 
     /* Client only */
 #ifdef INCLUDE_CLIENT_APIS
-    /*! Client subscription list. */
-    std::list<ClientSubscription> ClientSubList;
+    /*! Client subscriptions. */
+    ClientSubscriptionTable ClientSubs;
     /*! Active SSDP searches. */
     std::list<SsdpSearchArg> SsdpSearchList;
     int SubsOpsTimeoutMS{HTTP_DEFAULT_TIMEOUT * 1000};
+    /* Pass the UDA 2.0 multicast events to the callback */
+    bool MulticastEvents{false};
+    /* Deliver the events as UPNP_EVENT_RECEIVED_VIEW */
+    bool EventViews{false};
 #endif
 
     // Forbid copy construction and assignment
@@ -129,10 +134,14 @@ Upnp_Handle_Type GetHandleInfo(
     struct Handle_Info **HndInfo);
 
 
-// Global lock for the handle table
-extern std::mutex globalHndLock;
+// Global lock for the handle table. HANDLELOCK() for modifying the
+// table or handle data, including the device subscription lists (note
+// that GetSubscriptionSID() may erase expired entries).
+// HANDLELOCK_SHARED() for the read-only accesses.
+extern std::shared_mutex globalHndLock;
 
-#define HANDLELOCK() std::scoped_lock<std::mutex> hdllock(globalHndLock)
+#define HANDLELOCK() std::scoped_lock<std::shared_mutex> hdllock(globalHndLock)
+#define HANDLELOCK_SHARED() std::shared_lock<std::shared_mutex> hdllock(globalHndLock)
 
 /*!
  * \brief Get client handle info.
@@ -190,8 +199,11 @@ extern std::vector<NetIF::Interface> g_netifs;
 extern bool g_use_all_interfaces;
 
 extern unsigned int g_optionFlags;
+extern int g_webServerThreads;
 extern int g_bootidUpnpOrg;
 extern int g_configidUpnpOrg;
+/* Where device subscriptions are saved, see gena_device.cpp. Empty if not set */
+extern std::string g_subscriptionsFile;
 
 extern WebCallback_HostValidate g_hostvalidatecallback;
 extern void *g_hostvalidatecookie;
@@ -32,6 +32,7 @@
 #ifndef GENLIB_NET_HTTP_WEBSERVER_H
 #define GENLIB_NET_HTTP_WEBSERVER_H
 
+#include <cstdint>
 #include <ctime>
 #include <string>
 
@@ -85,6 +86,9 @@ int web_server_set_cors(
     /*! [in] String having the Access-Control-Allow-Origin string. */
     const char *cors_string);
 
+/* Set the bandwidth limits, in bytes per second. 0 means unlimited */
+void web_server_set_rate_limits(int64_t global_rate, int64_t client_rate);
+
 /* Add a locally served path */
 int web_server_set_localdoc(
     const std::string& path, const std::string& data, time_t last_modified);
@@ -94,6 +98,13 @@ int web_server_add_virtual_dir(
     const char *dirname, const void *cookie, const void **oldcookie);
 int web_server_remove_virtual_dir(const char *dirname);
 void web_server_clear_virtual_dirs();
+/* Discard cached VirtualDir GetInfo results for path, or all if path is null */
+void web_server_clear_info_cache(const char *path);
+
+/* Signal that data is ready for a VDCallback_ReadAsync transfer */
+int web_server_read_ready(uint64_t token);
+/* Fail all transfers waiting for data. Called before stopping the HTTP server */
+void web_server_abort_async_reads();
 
 #endif /* GENLIB_NET_HTTP_WEBSERVER_H */
 
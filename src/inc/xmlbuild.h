@@ -0,0 +1,207 @@
+/*******************************************************************************
+ *
+ * Copyright (c) 2026 J.F. Dockes
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * - Neither name of Intel Corporation nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL INTEL OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#ifndef _XMLBUILD_H_INCLUDED_
+#define _XMLBUILD_H_INCLUDED_
+
+/* Output helpers for the SOAP and GENA XML messages.
+
+   The escaping scans 16 bytes at a time for the characters which need
+   it, with SSE2 (always available on x86-64) or NEON (aarch64), and
+   copies the clean runs in one operation. The positions of the special
+   characters in a block come from the comparison mask, so the input is
+   never looked at byte by byte, except for the tail. */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define XMLBUILD_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define XMLBUILD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace xmlbuild {
+
+inline bool needsQuote(char c)
+{
+    return c == '<' || c == '>' || c == '&' || c == '"' || c == '\'';
+}
+
+inline void appendEntity(std::string& out, char c)
+{
+    switch (c) {
+    case '"': out.append("&quot;", 6); break;
+    case '&': out.append("&amp;", 5); break;
+    case '<': out.append("&lt;", 4); break;
+    case '>': out.append("&gt;", 4); break;
+    default: out.append("&apos;", 6); break;
+    }
+}
+
+inline int lowestBit(unsigned int mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return static_cast<int>(idx);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/* Append the XML-escaped input to out */
+inline void appendQuoted(std::string& out, std::string_view in)
+{
+    const char *s = in.data();
+    size_t len = in.size();
+    // Start of the current run of characters which need no escaping
+    size_t run = 0;
+    size_t i = 0;
+#if defined(XMLBUILD_SSE2) || defined(XMLBUILD_NEON)
+#if defined(XMLBUILD_SSE2)
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i quot = _mm_set1_epi8('"');
+    const __m128i apos = _mm_set1_epi8('\'');
+#else
+    const uint8x16_t lt = vdupq_n_u8('<');
+    const uint8x16_t gt = vdupq_n_u8('>');
+    const uint8x16_t amp = vdupq_n_u8('&');
+    const uint8x16_t quot = vdupq_n_u8('"');
+    const uint8x16_t apos = vdupq_n_u8('\'');
+#endif
+    for (; i + 16 <= len; i += 16) {
+#if defined(XMLBUILD_SSE2)
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, quot)),
+                         _mm_cmpeq_epi8(v, apos)));
+        auto mask = static_cast<unsigned int>(_mm_movemask_epi8(m));
+        if (mask == 0) {
+            continue;
+        }
+#else
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(s + i));
+        uint8x16_t m = vorrq_u8(
+            vorrq_u8(vceqq_u8(v, lt), vceqq_u8(v, gt)),
+            vorrq_u8(vorrq_u8(vceqq_u8(v, amp), vceqq_u8(v, quot)), vceqq_u8(v, apos)));
+        if (vmaxvq_u8(m) == 0) {
+            continue;
+        }
+        // No movemask on NEON: narrow each byte to 4 bits and test these.
+        uint64_t nibbles = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        unsigned int mask = 0;
+        for (int bit = 0; bit < 16; bit++) {
+            if (nibbles & (uint64_t(0xf) << (4 * bit))) {
+                mask |= 1U << bit;
+            }
+        }
+#endif
+        while (mask) {
+            size_t pos = i + lowestBit(mask);
+            out.append(s + run, pos - run);
+            appendEntity(out, s[pos]);
+            run = pos + 1;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (needsQuote(s[i])) {
+            out.append(s + run, i - run);
+            appendEntity(out, s[i]);
+            run = i + 1;
+        }
+    }
+    out.append(s + run, len - run);
+}
+
+/* Builds a message in a single buffer, sized once from an estimate
+   computed by the caller. */
+class XMLBuilder {
+public:
+    explicit XMLBuilder(size_t sizehint) {
+        m_out.reserve(sizehint);
+    }
+    XMLBuilder& append(std::string_view s) {
+        m_out.append(s);
+        return *this;
+    }
+    XMLBuilder& appendQuoted(std::string_view s) {
+        xmlbuild::appendQuoted(m_out, s);
+        return *this;
+    }
+    /* <name>value</name>, with the value escaped if quote is set */
+    XMLBuilder& element(std::string_view name, std::string_view value, bool quote = true) {
+        m_out += '<';
+        m_out.append(name);
+        m_out += '>';
+        if (quote) {
+            xmlbuild::appendQuoted(m_out, value);
+        } else {
+            m_out.append(value);
+        }
+        m_out += "</";
+        m_out.append(name);
+        m_out += '>';
+        return *this;
+    }
+    std::string take() {
+        return std::move(m_out);
+    }
+private:
+    std::string m_out;
+};
+
+/* Estimate for a sequence of elements: tags, values, and some room for escaping */
+template <class T> size_t elementsSize(const T& namevals)
+{
+    size_t size = 0;
+    for (const auto& [name, value] : namevals) {
+        size += 2 * name.size() + value.size() + value.size() / 8 + 8;
+    }
+    return size;
+}
+
+} // namespace xmlbuild
+
+#endif /* _XMLBUILD_H_INCLUDED_ */
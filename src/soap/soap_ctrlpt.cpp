@@ -43,6 +43,7 @@
 #include "statcodes.h"
 #include "upnpapi.h"
 #include "uri.h"
+#include "xmlbuild.h"
 
 #ifdef USE_EXPAT
 #include "expatmm.h"
@@ -183,13 +184,6 @@ int SoapSendAction(
     respdata.clear();
     long timeoutms = opts.timeoutms >= 0 ? opts.timeoutms : 1000L * HTTP_DEFAULT_TIMEOUT;
     
-    /* Action: name and namespace (servicetype) */
-    std::ostringstream act;
-    act << "<u:" << actionName << R"( xmlns:u=")" << serviceType << R"(">)" "\n";
-    /* Action arguments */
-    for (const auto& [name, val] : actionArgs)
-        act << "<" << name << ">" << xmlQuote(val) << "</" << name << ">\n";
-    act << "</u:" << actionName << ">\n";
     
     /* parse url */
     uri_type url;
@@ -201,11 +195,25 @@ int SoapSendAction(
                "soapSendAction: hostport [%s] path [%s] action [%s]\n",
                url.hostport.text.c_str(), url.path.c_str(), actionName.c_str());
 
-    std::string payload{xml_start};
+    xmlbuild::XMLBuilder builder(
+        xml_start.size() + xml_header_start.size() + xml_header_str.size() +
+        xml_header_end.size() + xml_body_start.size() + 2 * actionName.size() +
+        serviceType.size() + 40 + xmlbuild::elementsSize(actionArgs) + xml_end.size());
+    builder.append(xml_start);
     if (!xml_header_str.empty()) {
-        payload += xml_header_start + xml_header_str + xml_header_end;
+        builder.append(xml_header_start).append(xml_header_str).append(xml_header_end);
+    }
+    /* Action: name and namespace (servicetype) */
+    builder.append(xml_body_start);
+    builder.append("<u:").append(actionName).append(R"( xmlns:u=")").append(serviceType)
+        .append(R"(">)" "\n");
+    /* Action arguments */
+    for (const auto& [name, val] : actionArgs) {
+        builder.element(name, val).append("\n");
     }
-    payload += xml_body_start + act.str() + xml_end;
+    builder.append("</u:").append(actionName).append(">\n");
+    builder.append(xml_end);
+    std::string payload = builder.take();
     
     std::string soapaction = std::string(R"(SOAPACTION: ")") + serviceType + "#" +
         actionName + R"(")";
@@ -54,6 +54,7 @@
 #include "soaplib.h"
 #include "statcodes.h"
 #include "upnpapi.h"
+#include "xmlbuild.h"
 
 #define SREQ_HDR_NOT_FOUND     -1
 #define SREQ_BAD_HDR_FORMAT     -2
@@ -122,6 +123,7 @@ static void send_error_response(
                             get_sdk_device_info(productversion).c_str());
     /* We do as the original code, but should this not be error_code? */
     mhdt->httpstatus = 500;
+    mhdt->respsize = static_cast<int64_t>(txt.size());
 }
 
 /* Sends the SOAP action response. */
@@ -132,21 +134,27 @@ static void send_action_response(
     static const std::string start_body{bodyprolog};
     static const std::string end_body = "</s:Body></s:Envelope>";
 
-    std::ostringstream response;
-    response << start_body;
-    response << "<u:" << soap_info->action_name << "Response" <<
-        R"( xmlns:u=")" << soap_info->service_type << R"(">)" "\n";
-    for (const auto& [name, val] : data)
-        response << "<" << name << ">" << xmlQuote(val) << "</" << name << ">\n";
-    response << "</u:" << soap_info->action_name << "Response" << ">\n";
-    response << end_body;
-    const std::string& txt(response.str());
+    std::string_view actname{soap_info->action_name};
+    std::string_view servtype{soap_info->service_type};
+    xmlbuild::XMLBuilder response(
+        start_body.size() + 2 * actname.size() + servtype.size() + 40 +
+        xmlbuild::elementsSize(data) + end_body.size());
+    response.append(start_body);
+    response.append("<u:").append(actname).append("Response")
+        .append(R"( xmlns:u=")").append(servtype).append(R"(">)" "\n");
+    for (const auto& [name, val] : data) {
+        response.element(name, val).append("\n");
+    }
+    response.append("</u:").append(actname).append("Response>\n");
+    response.append(end_body);
+    const std::string txt = response.take();
     UpnpPrintf(UPNP_INFO, SOAP, __FILE__, __LINE__, "Action Response data: [%s]\n", txt.c_str());
     mhdt->response = MHD_create_response_from_buffer(
         txt.size(), const_cast<char*>(txt.c_str()), MHD_RESPMEM_MUST_COPY);
     MHD_add_response_header(
         mhdt->response, "SERVER", get_sdk_device_info(soap_info->productversion).c_str());
     mhdt->httpstatus = 200;
+    mhdt->respsize = static_cast<int64_t>(txt.size());
 }
 
 
@@ -192,7 +200,7 @@ protected:
             m_args.emplace_back(name, m_chardata);
         }
         if (!m_isresp && m_path.size() >= 3) {
-            outxml += xmlQuote(m_chardata);
+            xmlbuild::appendQuoted(outxml, m_chardata);
             outxml += std::string("</") + name + ">";
         }
         m_chardata.clear();
@@ -290,7 +298,7 @@ static int get_dev_service(const MHDTransaction *mhdt, soap_devserv_t *soap_info
     int device_hnd;
     service_info *serv_info;
 
-    HANDLELOCK();
+    HANDLELOCK_SHARED();
 
     auto hdltp = GetDeviceHandleInfoForPath(mhdt->url, &device_hnd, &hdlinfo, &serv_info);
 
@@ -214,7 +214,7 @@ void ssdp_handle_ctrlpt_msg(SSDPPacketParser& parser, const struct sockaddr_stor
     int matched = 0;
 
     {    
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         /* Get client info. We are assuming that there can be only one
            client supported at a time */
         if (GetClientHandleInfo(&handle, &ctrlpt_info) != HND_CLIENT) {
@@ -337,7 +337,7 @@ void ssdp_handle_ctrlpt_msg(SSDPPacketParser& parser, const struct sockaddr_stor
         }
         {
             /* check each current search */
-            HANDLELOCK();
+            HANDLELOCK_SHARED();
             if (GetClientHandleInfo(&handle, &ctrlpt_info) != HND_CLIENT) {
                 return;
             }
@@ -47,9 +47,11 @@
 #include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
 struct SsdpSearchReply {
     SsdpSearchReply(int a, UpnpDevice_Handle h, const sockaddr_storage* da, SsdpEntity e)
@@ -120,7 +122,7 @@ void ssdp_handle_device_request(const SSDPPacketParser& parser, struct sockaddr_
     for (;;) {
         int maxAge;
         {
-            HANDLELOCK();
+            HANDLELOCK_SHARED();
             /* device info. */
             switch (GetDeviceHandleInfo(start, &handle, &dev_info)) {
             case HND_DEVICE:
@@ -624,7 +626,7 @@ static int AdvertiseAndReplyOneDest(
     {
         // We make copies of everything with the handle table lock held, so as not to hold it while
         // sending the advertisements. Not sure that this is actually useful.
-        HANDLELOCK();
+        HANDLELOCK_SHARED();
         if (GetHandleInfo(Hnd, &SInfoPtr) != HND_DEVICE) {
             return UPNP_E_INVALID_HANDLE;
         }
@@ -871,5 +873,108 @@ exitfunc:
     return ret;
 }
 
+/* Sockets for the UDA 2.0 multicast events, one per interface (IPv6)
+   or address (IPv4). Events can be frequent, so the sockets are created
+   on the first one and kept until UpnpFinish(). */
+struct McastEventSocket {
+    SOCKET sock;
+    bool ipv6;
+};
+static std::vector<McastEventSocket> mcastEventSockets;
+static bool mcastEventSocketsInit{false};
+static std::mutex mcastEventMutex;
+
+static void createMcastEventSockets()
+{
+    std::string lochost;
+    for (const auto& netif : g_netifs) {
+#ifdef UPNP_ENABLE_IPV6
+        if (using_ipv6() && netif.firstipv6addr()) {
+            SOCKET sock = createMulticastSocket6(netif.getindex(), lochost);
+            if (sock != INVALID_SOCKET) {
+                mcastEventSockets.push_back({sock, true});
+            }
+        }
+#endif /* UPNP_ENABLE_IPV6 */
+        for (const auto& ipaddr : netif.getaddresses().first) {
+            if (ipaddr.family() != NetIF::IPAddr::Family::IPV4)
+                continue;
+            const struct sockaddr_storage& fss{ipaddr.getaddr()};
+            SOCKET sock = createMulticastSocket4(
+                reinterpret_cast<const struct sockaddr_in*>(&fss), lochost);
+            if (sock != INVALID_SOCKET) {
+                mcastEventSockets.push_back({sock, false});
+            }
+        }
+    }
+    mcastEventSocketsInit = true;
+}
+
+void ssdpCloseMulticastEventSockets()
+{
+    std::scoped_lock lck(mcastEventMutex);
+    for (auto& mes : mcastEventSockets) {
+        UpnpCloseSocket(mes.sock);
+    }
+    mcastEventSockets.clear();
+    mcastEventSocketsInit = false;
+}
+
+int ssdpSendMulticastEvent(const std::string& headers, const std::string& body)
+{
+    auto packet = [&headers, &body](const std::string& host) {
+        std::string out;
+        out.reserve(headers.size() + body.size() + 100);
+        out += "NOTIFY * HTTP/1.0\r\nHOST: ";
+        out += host;
+        out += "\r\n";
+        out += headers;
+        out += "CONTENT-LENGTH: " + std::to_string(body.size()) + "\r\n\r\n";
+        out += body;
+        return out;
+    };
+    auto pckt6 = packet(std::string("[") + GENA_MCAST_IPV6_LINKLOCAL + "]:" +
+                        std::to_string(GENA_MCAST_PORT));
+    if (pckt6.size() > GENA_MCAST_MAX_PACKET) {
+        UpnpPrintf(UPNP_INFO, SSDP, __FILE__, __LINE__,
+                   "ssdpSendMulticastEvent: event too big for a datagram\n");
+        return UPNP_E_INVALID_PARAM;
+    }
+    auto pckt4 = packet(std::string(GENA_MCAST_IP) + ":" + std::to_string(GENA_MCAST_PORT));
+
+    struct sockaddr_storage dss4 = {};
+    auto dest4 = reinterpret_cast<struct sockaddr_in *>(&dss4);
+    dest4->sin_family = static_cast<sa_family_t>(AF_INET);
+    inet_pton(AF_INET, GENA_MCAST_IP, &dest4->sin_addr);
+    dest4->sin_port = htons(GENA_MCAST_PORT);
+#ifdef UPNP_ENABLE_IPV6
+    struct sockaddr_storage dss6 = {};
+    auto dest6 = reinterpret_cast<struct sockaddr_in6 *>(&dss6);
+    dest6->sin6_family = static_cast<sa_family_t>(AF_INET6);
+    inet_pton(AF_INET6, GENA_MCAST_IPV6_LINKLOCAL, &dest6->sin6_addr);
+    dest6->sin6_port = htons(GENA_MCAST_PORT);
+#endif /* UPNP_ENABLE_IPV6 */
+
+    int sent = 0;
+    std::scoped_lock lck(mcastEventMutex);
+    if (!mcastEventSocketsInit) {
+        createMcastEventSockets();
+    }
+    for (const auto& mes : mcastEventSockets) {
+#ifdef UPNP_ENABLE_IPV6
+        if (mes.ipv6) {
+            if (sendPackets(mes.sock, &dss6, 1, &pckt6) == UPNP_E_SUCCESS) {
+                sent++;
+            }
+            continue;
+        }
+#endif /* UPNP_ENABLE_IPV6 */
+        if (sendPackets(mes.sock, &dss4, 1, &pckt4) == UPNP_E_SUCCESS) {
+            sent++;
+        }
+    }
+    return sent ? UPNP_E_SUCCESS : UPNP_E_NETWORK_ERROR;
+}
+
 #endif /* EXCLUDE_SSDP */
 #endif /* INCLUDE_DEVICE_APIS */
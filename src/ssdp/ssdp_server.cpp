@@ -38,6 +38,7 @@
 #include "ssdplib.h"
 
 #include "ThreadPool.h"
+#include "gena_ctrlpt.h"
 #include "genut.h"
 #include "upnpapi.h"
 #include "uri.h"
@@ -292,7 +293,40 @@ void readFromSSDPSocket(SOCKET socket)
     }
 }
 
-static int create_ssdp_sock_v4(SOCKET *ssdpSock)
+#ifdef INCLUDE_CLIENT_APIS
+class MulticastEventJobWorker : public JobWorker {
+public:
+    MulticastEventJobWorker(std::unique_ptr<ssdp_thread_data> data, size_t len)
+        : m_data(std::move(data)), m_len(len) {}
+    void work() override {
+#if EXCLUDE_GENA == 0
+        gena_process_multicast_event(m_data->packet(), m_len, &m_data->dest_addr);
+#endif
+    }
+    std::unique_ptr<ssdp_thread_data> m_data;
+    size_t m_len;
+};
+
+void readFromEventSocket(SOCKET socket)
+{
+    auto data = std::make_unique<ssdp_thread_data>();
+    auto sap = reinterpret_cast<struct sockaddr *>(&data->dest_addr);
+    socklen_t socklen = sizeof(data->dest_addr);
+    ssize_t cnt = recvfrom(socket, data->packet(), data->size() - 1, 0, sap, &socklen);
+    if (cnt > 0) {
+        data->packet()[cnt] = '\0';
+        UpnpPrintf(UPNP_ALL, SSDP, __FILE__, __LINE__,
+                   "Multicast event from host %s\n", NetIF::IPAddr(sap).straddr().c_str());
+        auto worker = std::make_unique<MulticastEventJobWorker>(std::move(data), cnt);
+        gRecvThreadPool.addJob(std::move(worker));
+    }
+}
+#endif /* INCLUDE_CLIENT_APIS */
+
+// Create a socket listening to a multicast group on all the
+// interfaces: SSDP, or the UDA 2.0 multicast events.
+static int create_ssdp_sock_v4(SOCKET *ssdpSock, const char *group = SSDP_IP,
+                               int port = SSDP_PORT)
 {
     int onOff;
     struct sockaddr_storage ss = {};
@@ -326,7 +360,7 @@ static int create_ssdp_sock_v4(SOCKET *ssdpSock)
 
     ssdpAddr4->sin_family = static_cast<sa_family_t>(AF_INET);
     ssdpAddr4->sin_addr.s_addr = htonl(INADDR_ANY);
-    ssdpAddr4->sin_port = htons(SSDP_PORT);
+    ssdpAddr4->sin_port = htons(port);
     ret = bind(*ssdpSock, reinterpret_cast<struct sockaddr *>(ssdpAddr4), sizeof(*ssdpAddr4));
     if (ret == -1) {
         errorcause = "bind(INADDR_ANY)";
@@ -343,7 +377,7 @@ static int create_ssdp_sock_v4(SOCKET *ssdpSock)
             errorcause = "inet_pton() error";
             goto error_handler;
         }
-        if (inet_pton(AF_INET, SSDP_IP, &(ssdpMcastAddr.imr_multiaddr)) != 1) {
+        if (inet_pton(AF_INET, group, &(ssdpMcastAddr.imr_multiaddr)) != 1) {
             errorcause = "inet_pton() error for multicast address";
             goto error_handler;
         }
@@ -449,7 +483,8 @@ error_handler:
 
 #ifdef UPNP_ENABLE_IPV6
 
-static int create_ssdp_sock_v6(bool isulagua, SOCKET *ssdpSock)
+static int create_ssdp_sock_v6(bool isulagua, SOCKET *ssdpSock, const char *group = nullptr,
+                               int port = SSDP_PORT)
 {
     int onOff;
     int ret = UPNP_E_SOCKET_ERROR;
@@ -495,14 +530,17 @@ static int create_ssdp_sock_v6(bool isulagua, SOCKET *ssdpSock)
         ssdpAddr6->sin6_family = static_cast<sa_family_t>(AF_INET6);
         ssdpAddr6->sin6_addr = in6addr_any;
         ssdpAddr6->sin6_scope_id = 0;
-        ssdpAddr6->sin6_port = htons(SSDP_PORT);
+        ssdpAddr6->sin6_port = htons(port);
         ret = bind(*ssdpSock, reinterpret_cast<struct sockaddr *>(ssdpAddr6), sizeof(*ssdpAddr6));
         if (ret == -1) {
             errorcause = "bind()";
             goto error_handler;
         }
         struct ipv6_mreq ssdpMcastAddr = {};
-        NetIF::IPAddr ipa(isulagua? SSDP_IPV6_SITELOCAL : SSDP_IPV6_LINKLOCAL);
+        if (nullptr == group) {
+            group = isulagua ? SSDP_IPV6_SITELOCAL : SSDP_IPV6_LINKLOCAL;
+        }
+        NetIF::IPAddr ipa(group);
         struct sockaddr_in6 sa6;
         ipa.copyToAddr(reinterpret_cast<struct sockaddr*>(&sa6));
         memcpy(&ssdpMcastAddr.ipv6mr_multiaddr, &sa6.sin6_addr,
@@ -619,6 +657,8 @@ static void maybeCLoseAndInvalidate(SOCKET& s, int doclose)
 static void closeSockets(MiniServerSockArray *sockets, int doclose)
 {
 #ifdef INCLUDE_CLIENT_APIS
+        maybeCLoseAndInvalidate(sockets->eventSock4, doclose);
+        maybeCLoseAndInvalidate(sockets->eventSock6, doclose);
         for (SOCKET& socket: sockets->ssdpReqSock4List) {
             maybeCLoseAndInvalidate(socket, doclose);
         }
@@ -711,6 +751,22 @@ int get_ssdp_sockets(MiniServerSockArray *out, int startPort)
         netif_idx++;
     }
 
+#if EXCLUDE_GENA == 0
+    // Multicast event reception. Not fatal: the CP still gets the
+    // events for its subscriptions.
+    if (hasIPV4 && create_ssdp_sock_v4(&out->eventSock4, GENA_MCAST_IP, GENA_MCAST_PORT)
+        != UPNP_E_SUCCESS) {
+        out->eventSock4 = INVALID_SOCKET;
+    }
+#ifdef UPNP_ENABLE_IPV6
+    if (using_ipv6() && !apiFirstIPV6Str().empty() &&
+        create_ssdp_sock_v6(false, &out->eventSock6, GENA_MCAST_IPV6_LINKLOCAL,
+                            GENA_MCAST_PORT) != UPNP_E_SUCCESS) {
+        out->eventSock6 = INVALID_SOCKET;
+    }
+#endif /* UPNP_ENABLE_IPV6 */
+#endif /* EXCLUDE_GENA */
+
 #endif /* INCLUDE_CLIENT_APIS */
 
     /* Create the IPv4 socket for SSDP */
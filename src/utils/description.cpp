@@ -88,6 +88,45 @@ private:
     UPnPDeviceDesc m_tdevice;
 };
 
+class UPnPSCPDMulticastParser : public XMLPARSERTP {
+public:
+    UPnPSCPDMulticastParser(const string& input, vector<string>& names)
+        : XMLPARSERTP(input), m_names(names) {}
+
+protected:
+    void EndElement(const XML_Char *name) override {
+        if (!strcmp(name, "name") && m_path.size() >= 2 &&
+            !strcmp(m_path[m_path.size()-2].name.c_str(), "stateVariable")) {
+            const auto& attrs = m_path[m_path.size()-2].attributes;
+            auto sendevents = attrs.find("sendEvents");
+            auto multicast = attrs.find("multicast");
+            if (sendevents != attrs.end() && multicast != attrs.end() &&
+                !stringlowercmp("yes", sendevents->second) &&
+                !stringlowercmp("yes", multicast->second)) {
+                trimstring(m_chardata, " \t\n\r");
+                m_names.push_back(m_chardata);
+            }
+        }
+        m_chardata.clear();
+    }
+
+    void CharacterData(const XML_Char *s, int len) override {
+        if (s == nullptr || *s == 0)
+            return;
+        m_chardata.append(s, len);
+    }
+
+private:
+    vector<string>& m_names;
+    string m_chardata;
+};
+
+bool UPnPSCPDMulticastVariables(const string& scpd, vector<string>& names)
+{
+    UPnPSCPDMulticastParser mparser(scpd, names);
+    return mparser.Parse();
+}
+
 static string baseurl(const string& url)
 {
     string::size_type pos = url.find("://");
@@ -30,6 +30,7 @@
 
 
 #include "genut.h"
+#include "xmlbuild.h"
 
 #include <cstring>
 #include <string>
@@ -64,28 +65,8 @@ size_t upnp_strlcpy(char *dst, const char *src, size_t dsize)
 std::string xmlQuote(const std::string& in)
 {
     std::string out;
-    out.reserve(in.size());
-    for (char i : in) {
-        switch (i) {
-        case '"':
-            out += "&quot;";
-            break;
-        case '&':
-            out += "&amp;";
-            break;
-        case '<':
-            out += "&lt;";
-            break;
-        case '>':
-            out += "&gt;";
-            break;
-        case '\'':
-            out += "&apos;";
-            break;
-        default:
-            out += i;
-        }
-    }
+    out.reserve(in.size() + in.size() / 8);
+    xmlbuild::appendQuoted(out, in);
     return out;
 }
 
@@ -307,6 +307,7 @@ int http_SendStatusResponse(MHDTransaction *mhdt, int status_code)
         body.str().size(), const_cast<char*>(body.str().c_str()), MHD_RESPMEM_MUST_COPY);
     MHD_add_response_header(mhdt->response, "Content-Type", "text/html");
     mhdt->httpstatus = status_code;
+    mhdt->respsize = static_cast<int64_t>(body.str().size());
     return UPNP_E_SUCCESS;
 }
 
@@ -45,12 +45,18 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cinttypes>
+#include <condition_variable>
+#include <list>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
 
 #include "genut.h"
+#include "mimetypes.h"
 #include "ssdplib.h"
 #include "statcodes.h"
 #include "upnpapi.h"
@@ -72,8 +78,19 @@
 #ifdef _MSC_VER
 #include <io.h>
 #define OPEN _open
+#define READ _read
+#define CLOSE _close
+#define DUP _dup
+#define PREAD(FD, BUF, CNT, OFF) (_lseeki64((FD), (OFF), SEEK_SET) < 0 ? -1 : _read((FD), (BUF), (CNT)))
+// No real pread: duplicated descriptors would share the file offset
+#define NO_SHARED_FDS
 #else
+#include <unistd.h>
 #define OPEN open
+#define READ read
+#define CLOSE close
+#define DUP dup
+#define PREAD pread
 #endif
 
 /*!
@@ -85,6 +102,8 @@ enum resp_type {
     RESP_XMLDOC,
 };
 
+struct LocalDoc;
+
 struct SendInstruction {
     std::string AcceptLanguageHeader;
     /* Offset to begin reading at. Set by range header if present */
@@ -98,115 +117,76 @@ struct SendInstruction {
     bool IsPartial{false};
     int64_t TotalSize{0};
     const void *cookie{nullptr};
-    /* Copy of the data if this request is for a localdoc, e.g. the
-       description document set by the API if we serve it this way,
-       instead of as a local file or a virtualdir entry (this depends
-       on the kind of registerrootdevice call) */
-    std::string data;
+    /* Reference to the document if this request is for a localdoc,
+       e.g. the description document set by the API if we serve it
+       this way, instead of as a local file or a virtualdir entry
+       (this depends on the kind of registerrootdevice call) */
+    std::shared_ptr<const LocalDoc> localdoc;
     /* This is set by the Virtual Dir GetInfo user callback and passed to 
        further VirtualDirectory calls for the same request */
     const void* request_cookie{nullptr};
+    /* For a RESP_FILEDOC, the file data or an open descriptor, if
+       obtained from the file cache. We own the descriptor until it
+       is handed over to MHD. */
+    std::shared_ptr<const std::string> filedata;
+    int fd{-1};
+
+    SendInstruction() = default;
+    ~SendInstruction() {
+        if (fd >= 0)
+            CLOSE(fd);
+    }
+    SendInstruction(const SendInstruction&) = delete;
+    SendInstruction& operator=(const SendInstruction&) = delete;
 };
 
 /*!
  * module variables - Globals, static and externs.
  */
 
-static const std::unordered_map<std::string_view, std::string_view> gEncodedMediaTypes = {
-    {"aif", "audio/aiff"},
-    {"aifc", "audio/aiff"},
-    {"aiff", "audio/aiff"},
-    {"asf", "video/x-ms-asf"},
-    {"asx", "video/x-ms-asf"},
-    {"au", "audio/basic"},
-    {"avi", "video/msvideo"},
-    {"bmp", "image/bmp"},
-    {"css", "text/css"},
-    {"dcr", "application/x-director"},
-    {"dib", "image/bmp"},
-    {"dir", "application/x-director"},
-    {"dxr", "application/x-director"},
-    {"gif", "image/gif"},
-    {"hta", "text/hta"},
-    {"htm", "text/html"},
-    {"html", "text/html"},
-    {"jar", "application/java-archive"},
-    {"jfif", "image/pjpeg"},
-    {"jpe", "image/jpeg"},
-    {"jpeg", "image/jpeg"},
-    {"jpg", "image/jpeg"},
-    {"js", "application/x-javascript"},
-    {"kar", "audio/midi"},
-    {"m3u", "audio/mpegurl"},
-    {"mid", "audio/midi"},
-    {"midi", "audio/midi"},
-    {"mov", "video/quicktime"},
-    {"mp2v", "video/x-mpeg2"},
-    {"mp3", "audio/mpeg"},
-    {"mpe", "video/mpeg"},
-    {"mpeg", "video/mpeg"},
-    {"mpg", "video/mpeg"},
-    {"mpv", "video/mpeg"},
-    {"mpv2", "video/x-mpeg2"},
-    {"pdf", "application/pdf"},
-    {"pjp", "image/jpeg"},
-    {"pjpeg", "image/jpeg"},
-    {"plg", "text/html"},
-    {"pls", "audio/scpls"},
-    {"png", "image/png"},
-    {"qt", "video/quicktime"},
-    {"ram", "audio/x-pn-realaudio"},
-    {"rmi", "audio/mid"},
-    {"rmm", "audio/x-pn-realaudio"},
-    {"rtf", "application/rtf"},
-    {"shtml", "text/html"},
-    {"smf", "audio/midi"},
-    {"snd", "audio/basic"},
-    {"spl", "application/futuresplash"},
-    {"ssm", "application/streamingmedia"},
-    {"swf", "application/x-shockwave-flash"},
-    {"tar", "application/tar"},
-    {"tcl", "application/x-tcl"},
-    {"text", "text/plain"},
-    {"tif", "image/tiff"},
-    {"tiff", "image/tiff"},
-    {"txt", "text/plain"},
-    {"ulw", "audio/basic"},
-    {"wav", "audio/wav"},
-    {"wax", "audio/x-ms-wax"},
-    {"wm", "video/x-ms-wm"},
-    {"wma", "audio/x-ms-wma"},
-    {"wmv", "video/x-ms-wmv"},
-    {"wvx", "video/x-ms-wvx"},
-    {"xbm", "image/x-xbitmap"},
-    {"xml", "text/xml"},
-    {"xsl", "text/xml"},
-    {"z", "application/x-compress"},
-    {"zip", "application/zip"}
-};
-
-
-/*! Global variable. A file system directory which serves as webserver
-  root. If this is not set from the API UpnpSetWebServerRootDir()
-  call, we do not serve files from the file system at all (only
-  possibly the virtual dir and/or the localDocs). */
-static std::string gDocumentRootDir;
-
-/*! Global variable. A string which is set in the header field. */
-static std::string gWebServerCorsString;
-
 struct LocalDoc {
     std::string data;
     time_t last_modified{};
 };
 
-// Data which we serve directly: usually description
-// documents. Indexed by path. Content-Type is always text/xml
-// The map is tested after the virtualdir, so the latter has priority.
-static std::map<std::string, LocalDoc> localDocs;
+/* Web server configuration. Request processing works on an immutable
+   snapshot, obtained with getWebConfig(). The setter functions build
+   a modified copy and swap it in, so that readers never wait for
+   them. The local documents are shared between the successive
+   snapshots and the responses being sent. */
+struct WebServerConfig {
+    /* A file system directory which serves as webserver root. If
+       this is not set from the API UpnpSetWebServerRootDir() call, we
+       do not serve files from the file system at all (only possibly
+       the virtual dir and/or the localDocs). */
+    std::string documentRootDir;
+    /* The Access-Control-Allow-Origin header value. */
+    std::string corsString;
+    /* Data which we serve directly: usually description
+       documents. Indexed by path. Content-Type is always text/xml
+       The map is tested after the virtualdir, so the latter has priority. */
+    std::map<std::string, std::shared_ptr<const LocalDoc>> localDocs;
+};
+
+static std::shared_ptr<const WebServerConfig> gWebConfig{std::make_shared<WebServerConfig>()};
 
+/* Serializes the configuration updates. Not used by readers. */
 static std::mutex gWebMutex;
 
+static std::shared_ptr<const WebServerConfig> getWebConfig()
+{
+    return std::atomic_load(&gWebConfig);
+}
+
+/* Apply func to a copy of the current configuration, then publish the result */
+template <class F> static void updateWebConfig(F func)
+{
+    std::scoped_lock lck(gWebMutex);
+    auto ncfg = std::make_shared<WebServerConfig>(*getWebConfig());
+    func(*ncfg);
+    std::atomic_store(&gWebConfig, std::shared_ptr<const WebServerConfig>(std::move(ncfg)));
+}
+
 class VirtualDirListEntry {
 public:
     std::string path;
@@ -222,15 +202,12 @@ static std::mutex vdlmutex;
 static int get_content_type(const char* filename, std::string& content_type)
 {
     std::string_view ctname{"application/octet-stream"};
-    content_type.clear();
     /* get ext */
     const char *e = strrchr(filename, '.');
     if (e) {
-        e++;
-        std::string le = stringtolower(e);
-        auto it = gEncodedMediaTypes.find(le);
-        if (it != gEncodedMediaTypes.end()) {
-            ctname = it->second;
+        auto mtype = mimetypes::mimetype_for_ext(e + 1);
+        if (!mtype.empty()) {
+            ctname = mtype;
         }
     }
     content_type = ctname;
@@ -242,18 +219,18 @@ int web_server_set_localdoc(const std::string& path, const std::string& data, ti
     if (path.empty() || path.front() != '/') {
         return UPNP_E_INVALID_PARAM;
     }
-    LocalDoc doc{data, last_modified};
-    std::scoped_lock lck(gWebMutex);
-    localDocs[path] = doc;
+    auto doc = std::make_shared<const LocalDoc>(LocalDoc{data, last_modified});
+    updateWebConfig([&path, &doc](WebServerConfig& cfg) {
+        cfg.localDocs[path] = std::move(doc);
+    });
     return UPNP_E_SUCCESS;
 }
 
 int web_server_unset_localdoc(const std::string& path)
 {
-    std::scoped_lock lck(gWebMutex);
-    auto it = localDocs.find(path);
-    if (it != localDocs.end())
-        localDocs.erase(it);
+    updateWebConfig([&path](WebServerConfig& cfg) {
+        cfg.localDocs.erase(path);
+    });
     return UPNP_E_SUCCESS;
 }
 
@@ -285,20 +262,203 @@ static int get_file_info(const char *filename, struct File_Info *info)
     return rc;
 }
 
+/* Cache for the files served from the document root. Small files are
+   kept in memory, bigger ones are kept open. The entries are trusted
+   for WEB_SERVER_FILE_CACHE_TTL seconds, then checked against the file
+   system size and modification time. */
+struct CachedFile {
+    std::string path;
+    int64_t size{0};
+    time_t mtime{0};
+    std::string content_type;
+    std::chrono::steady_clock::time_point checked;
+    /* Contents for small files */
+    std::shared_ptr<const std::string> data;
+    /* Open descriptor for bigger ones */
+    int fd{-1};
+};
+/* Most recently used at the front */
+static std::list<CachedFile> fileCacheLru;
+static std::unordered_map<std::string, std::list<CachedFile>::iterator> fileCacheIndex;
+static size_t fileCacheBytes;
+static int fileCacheFds;
+static std::mutex fileCacheMutex;
+
+/* Call with the lock held */
+static void fileCacheErase(std::list<CachedFile>::iterator it)
+{
+    if (it->data) {
+        fileCacheBytes -= it->data->size();
+    }
+    if (it->fd >= 0) {
+        CLOSE(it->fd);
+        fileCacheFds--;
+    }
+    fileCacheIndex.erase(it->path);
+    fileCacheLru.erase(it);
+}
+
+static void fileCacheClear()
+{
+    std::scoped_lock lck(fileCacheMutex);
+    while (!fileCacheLru.empty()) {
+        fileCacheErase(fileCacheLru.begin());
+    }
+}
+
+/* Set up the response source from a cache entry. Call with the lock held */
+static void fileCacheUse(const CachedFile& entry, struct File_Info *info,
+                         struct SendInstruction *RespInstr)
+{
+    info->is_directory = false;
+    info->is_readable = true;
+    info->file_length = entry.size;
+    info->last_modified = entry.mtime;
+    info->content_type = entry.content_type;
+    if (entry.data) {
+        RespInstr->filedata = entry.data;
+    } else if (entry.fd >= 0) {
+        RespInstr->fd = DUP(entry.fd);
+    }
+}
+
+/* Read a file and create a cache entry for it. Returns false if the
+   file can't be read or changed from what get_file_info() saw. */
+static bool fileCacheLoad(const std::string& path, const struct File_Info *info,
+                          CachedFile& entry)
+{
+    int fd = OPEN(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size != info->file_length ||
+        st.st_mtime != info->last_modified) {
+        CLOSE(fd);
+        return false;
+    }
+    entry.path = path;
+    entry.size = st.st_size;
+    entry.mtime = st.st_mtime;
+    entry.content_type = info->content_type;
+    entry.checked = std::chrono::steady_clock::now();
+    if (st.st_size <= WEB_SERVER_FILE_CACHE_MAX_FILE_SIZE) {
+        auto data = std::make_shared<std::string>(st.st_size, '\0');
+        size_t cnt = 0;
+        while (cnt < data->size()) {
+            auto ret = READ(fd, &(*data)[cnt], data->size() - cnt);
+            if (ret <= 0)
+                break;
+            cnt += ret;
+        }
+        CLOSE(fd);
+        if (cnt != data->size()) {
+            return false;
+        }
+        entry.data = std::move(data);
+    } else {
+#ifdef NO_SHARED_FDS
+        // Only cache the metadata: each response opens its own descriptor.
+        CLOSE(fd);
+#else
+        entry.fd = fd;
+#endif
+    }
+    return true;
+}
+
+/* Get file information for a document root file, using the file
+   cache. If a cache entry is used or created, RespInstr gets the
+   data or an open descriptor for the response. */
+static int get_file_info_cached(const std::string& path, struct File_Info *info,
+                                struct SendInstruction *RespInstr)
+{
+#if WEB_SERVER_FILE_CACHE_TTL > 0
+    auto now = std::chrono::steady_clock::now();
+    bool stale{false};
+    int64_t osize{0};
+    time_t omtime{0};
+    {
+        std::scoped_lock lck(fileCacheMutex);
+        auto it = fileCacheIndex.find(path);
+        if (it != fileCacheIndex.end()) {
+            fileCacheLru.splice(fileCacheLru.begin(), fileCacheLru, it->second);
+            const auto& entry = *it->second;
+            if (now - entry.checked < std::chrono::seconds(WEB_SERVER_FILE_CACHE_TTL)) {
+                fileCacheUse(entry, info, RespInstr);
+                return 0;
+            }
+            stale = true;
+            osize = entry.size;
+            omtime = entry.mtime;
+        }
+    }
+#endif
+
+    int ret = get_file_info(path.c_str(), info);
+
+#if WEB_SERVER_FILE_CACHE_TTL > 0
+    bool cacheable = ret == 0 && !info->is_directory && info->is_readable;
+    if (stale) {
+        std::scoped_lock lck(fileCacheMutex);
+        auto it = fileCacheIndex.find(path);
+        if (it != fileCacheIndex.end()) {
+            if (cacheable && osize == info->file_length && omtime == info->last_modified) {
+                it->second->checked = now;
+                fileCacheUse(*it->second, info, RespInstr);
+                return 0;
+            }
+            fileCacheErase(it->second);
+        }
+    }
+    if (!cacheable) {
+        return ret;
+    }
+    CachedFile entry;
+    if (!fileCacheLoad(path, info, entry)) {
+        // Let the normal path deal with it.
+        return ret;
+    }
+    std::scoped_lock lck(fileCacheMutex);
+    auto it = fileCacheIndex.find(path);
+    if (it != fileCacheIndex.end()) {
+        fileCacheErase(it->second);
+    }
+    if (entry.data) {
+        fileCacheBytes += entry.data->size();
+    } else if (entry.fd >= 0) {
+        fileCacheFds++;
+    }
+    fileCacheLru.push_front(std::move(entry));
+    fileCacheIndex[path] = fileCacheLru.begin();
+    fileCacheUse(fileCacheLru.front(), info, RespInstr);
+    while (fileCacheLru.size() > 1 && (fileCacheBytes > WEB_SERVER_FILE_CACHE_MAX_BYTES ||
+                                       fileCacheFds > WEB_SERVER_FD_CACHE_SIZE)) {
+        fileCacheErase(std::prev(fileCacheLru.end()));
+    }
+#endif
+    return ret;
+}
+
 int web_server_set_root_dir(const char *root_dir)
 {
-    gDocumentRootDir = root_dir;
+    std::string rootdir{root_dir};
     /* remove trailing '/', if any */
-    if (!gDocumentRootDir.empty() && gDocumentRootDir.back() == '/') {
-        gDocumentRootDir.pop_back();
+    if (!rootdir.empty() && rootdir.back() == '/') {
+        rootdir.pop_back();
     }
-
+    updateWebConfig([&rootdir](WebServerConfig& cfg) {
+        cfg.documentRootDir = std::move(rootdir);
+    });
+    fileCacheClear();
     return 0;
 }
 
 int web_server_set_cors(const char *cors_string)
 {
-    gWebServerCorsString = cors_string;
+    updateWebConfig([cors_string](WebServerConfig& cfg) {
+        cfg.corsString = cors_string;
+    });
     return 0;
 }
 
@@ -346,21 +506,121 @@ int web_server_remove_virtual_dir(const char *dirname)
     if (dirname == nullptr) {
         return UPNP_E_INVALID_PARAM;
     }
-    std::scoped_lock lock(vdlmutex);
-    for (auto it = virtualDirList.begin(); it != virtualDirList.end(); it++) {
-        if (it->path == dirname) {
-            virtualDirList.erase(it);
-            return UPNP_E_SUCCESS;
+    {
+        std::scoped_lock lock(vdlmutex);
+        auto it = std::find_if(virtualDirList.begin(), virtualDirList.end(),
+                               [dirname](const VirtualDirListEntry& e) {return e.path == dirname;});
+        if (it == virtualDirList.end()) {
+            return UPNP_E_INVALID_PARAM;
         }
+        virtualDirList.erase(it);
     }
-
-    return UPNP_E_INVALID_PARAM;
+    // The cookie value may be reused.
+    web_server_clear_info_cache(nullptr);
+    return UPNP_E_SUCCESS;
 }
 
 void web_server_clear_virtual_dirs()
 {
-    std::scoped_lock lock(vdlmutex);
-    virtualDirList.clear();
+    {
+        std::scoped_lock lock(vdlmutex);
+        virtualDirList.clear();
+    }
+    web_server_clear_info_cache(nullptr);
+}
+
+/* Cache for the VirtualDir GetInfo results, when the application
+   allows it by setting File_Info::cache_ttl. Indexed by virtual dir
+   cookie and path. */
+struct CachedInfo {
+    std::pair<const void*, std::string> key;
+    std::chrono::steady_clock::time_point expires;
+    int64_t file_length;
+    time_t last_modified;
+    int is_directory;
+    int is_readable;
+    std::string content_type;
+    std::vector<std::pair<std::string, std::string>> response_headers;
+};
+/* Most recently used at the front */
+static std::list<CachedInfo> infoCacheLru;
+static std::map<std::pair<const void*, std::string>, std::list<CachedInfo>::iterator> infoCacheIndex;
+static std::mutex infoCacheMutex;
+
+void web_server_clear_info_cache(const char *path)
+{
+    std::scoped_lock lck(infoCacheMutex);
+    for (auto it = infoCacheLru.begin(); it != infoCacheLru.end();) {
+        if (nullptr == path || it->key.second == path) {
+            infoCacheIndex.erase(it->key);
+            it = infoCacheLru.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+/* Call the application GetInfo callback, or use a cached result */
+static int vd_get_info(MHDTransaction *mhdt, const std::string& filename,
+                       struct File_Info *finfo, const void *cookie,
+                       const void **request_cookiep)
+{
+    auto key = std::make_pair(cookie, filename);
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::scoped_lock lck(infoCacheMutex);
+        auto it = infoCacheIndex.find(key);
+        if (it != infoCacheIndex.end()) {
+            auto& entry = *it->second;
+            if (now < entry.expires) {
+                infoCacheLru.splice(infoCacheLru.begin(), infoCacheLru, it->second);
+                finfo->file_length = entry.file_length;
+                finfo->last_modified = entry.last_modified;
+                finfo->is_directory = entry.is_directory;
+                finfo->is_readable = entry.is_readable;
+                finfo->content_type = entry.content_type;
+                finfo->response_headers = entry.response_headers;
+                *request_cookiep = nullptr;
+                return UPNP_E_SUCCESS;
+            }
+            infoCacheLru.erase(it->second);
+            infoCacheIndex.erase(it);
+        }
+    }
+
+    /* Data we supply as input to the callback. The GetInfo2 variant
+       gets a reference to the transaction headers instead of a copy */
+    finfo->cache_ttl = 0;
+    mhdt->copyClientAddress(&finfo->CtrlPtIPAddr);
+    int ret;
+    if (virtualDirCallback.get_info2) {
+        ret = virtualDirCallback.get_info2(
+            filename.c_str(), finfo, mhdt->headers, cookie, request_cookiep);
+    } else {
+        finfo->request_headers = mhdt->headers;
+        mhdt->copyHeader("user-agent", finfo->Os);
+        ret = virtualDirCallback.get_info(filename.c_str(), finfo, cookie, request_cookiep);
+    }
+    if (ret != UPNP_E_SUCCESS || finfo->cache_ttl <= 0) {
+        return ret;
+    }
+
+    CachedInfo entry{key, now + std::chrono::seconds(finfo->cache_ttl),
+                     finfo->file_length, finfo->last_modified, finfo->is_directory,
+                     finfo->is_readable, finfo->content_type, finfo->response_headers};
+    std::scoped_lock lck(infoCacheMutex);
+    auto it = infoCacheIndex.find(key);
+    if (it != infoCacheIndex.end()) {
+        infoCacheLru.erase(it->second);
+        infoCacheIndex.erase(it);
+    }
+    infoCacheLru.push_front(std::move(entry));
+    infoCacheIndex[key] = infoCacheLru.begin();
+    while (infoCacheLru.size() > WEB_SERVER_INFO_CACHE_SIZE) {
+        infoCacheIndex.erase(infoCacheLru.back().key);
+        infoCacheLru.pop_back();
+    }
+    return ret;
 }
 
 /*!
@@ -423,8 +683,8 @@ static int process_request(
     struct SendInstruction *RespInstr)
 {
     struct File_Info finfo;
-    LocalDoc localdoc;
-    
+    auto cfg = getWebConfig();
+
     assert(mhdt->method == HTTPMETHOD_GET ||
            mhdt->method == HTTPMETHOD_HEAD ||
            mhdt->method == HTTPMETHOD_POST ||
@@ -459,11 +719,6 @@ static int process_request(
     /* init */
     const VirtualDirListEntry *entryp{nullptr};
 
-    /* Data we supply as input to the file info gathering functions */
-    finfo.request_headers = mhdt->headers;
-    mhdt->copyClientAddress(&finfo.CtrlPtIPAddr);
-    mhdt->copyHeader("user-agent", finfo.Os);
-
     /* Unescape and canonize the path. Note that MHD has already
        stripped a possible query part ("?param=value...)  for us */
     std::string request_doc = remove_escaped_chars(mhdt->url);
@@ -477,13 +732,9 @@ static int process_request(
     }
     entryp = isFileInVirtualDir(request_doc);
     if (!entryp) {
-        std::scoped_lock lck(gWebMutex);
-        auto localdocit = localDocs.find(request_doc);
-        // Just make a copy. Could do better using a
-        // map<string,share_ptr> like the original, but I don't think
-        // that the perf impact is significant
-        if (localdocit != localDocs.end()) {
-            localdoc = localdocit->second;
+        auto localdocit = cfg->localDocs.find(request_doc);
+        if (localdocit != cfg->localDocs.end() && !localdocit->second->data.empty()) {
+            RespInstr->localdoc = localdocit->second;
         }
     }
     if (entryp) {
@@ -500,8 +751,8 @@ static int process_request(
         std::string bfilename{filename};
         filename += qs;
         /* get file info */
-        if (virtualDirCallback.get_info(filename.c_str(), &finfo, entryp->cookie,
-                                        &RespInstr->request_cookie) != UPNP_E_SUCCESS) {
+        if (vd_get_info(mhdt, filename, &finfo, entryp->cookie,
+                        &RespInstr->request_cookie) != UPNP_E_SUCCESS) {
             return HTTP_NOT_FOUND;
         }
         /* try index.html if req is a dir */
@@ -515,8 +766,8 @@ static int process_request(
             bfilename += temp_str;
             filename = bfilename + qs;
             /* get info */
-            if ((virtualDirCallback.get_info(filename.c_str(), &finfo, entryp->cookie,
-                                             &RespInstr->request_cookie) != UPNP_E_SUCCESS) ||
+            if ((vd_get_info(mhdt, filename, &finfo, entryp->cookie,
+                             &RespInstr->request_cookie) != UPNP_E_SUCCESS) ||
                 finfo.is_directory) {
                 return HTTP_NOT_FOUND;
             }
@@ -525,21 +776,20 @@ static int process_request(
         if (!finfo.is_readable) {
             return HTTP_FORBIDDEN;
         }
-    } else if (!localdoc.data.empty()) {
+    } else if (RespInstr->localdoc) {
         *rtype = RESP_XMLDOC;
         finfo.content_type = "text/xml";
-        finfo.file_length = localdoc.data.size();
+        finfo.file_length = RespInstr->localdoc->data.size();
         finfo.is_readable = true;
         finfo.is_directory = false;
-        finfo.last_modified = localdoc.last_modified;
-        RespInstr->data.swap(localdoc.data);
+        finfo.last_modified = RespInstr->localdoc->last_modified;
     } else {
         *rtype = RESP_FILEDOC;
-        if (gDocumentRootDir.empty()) {
+        if (cfg->documentRootDir.empty()) {
             return HTTP_FORBIDDEN;
         }
         /* get file name */
-        filename = gDocumentRootDir;
+        filename = cfg->documentRootDir;
         filename += request_doc;
         /* remove trailing slashes */
         while (!filename.empty() && filename.back() == '/') {
@@ -547,7 +797,7 @@ static int process_request(
         }
 
         /* get info on file */
-        if (get_file_info(filename.c_str(), &finfo) != 0) {
+        if (get_file_info_cached(filename, &finfo, RespInstr) != 0) {
             return HTTP_NOT_FOUND;
         }
         /* try index.html if req is a dir */
@@ -560,7 +810,7 @@ static int process_request(
             }
             filename += temp_str;
             /* get info */
-            if (get_file_info(filename.c_str(), &finfo) != 0 ||
+            if (get_file_info_cached(filename, &finfo, RespInstr) != 0 ||
                 finfo.is_directory) {
                 return HTTP_NOT_FOUND;
             }
@@ -600,8 +850,8 @@ static int process_request(
     if (RespInstr->AcceptLanguageHeader[0] && WEB_SERVER_CONTENT_LANGUAGE[0]) {
         headers["content-language"] = WEB_SERVER_CONTENT_LANGUAGE;
     }
-    if (!gWebServerCorsString.empty()) {
-        headers["Access-Control-Allow-Origin"] = gWebServerCorsString;
+    if (!cfg->corsString.empty()) {
+        headers["Access-Control-Allow-Origin"] = cfg->corsString;
     }
     {
         std::string date = make_date_string(0);
@@ -616,23 +866,302 @@ static int process_request(
     return HTTP_OK;
 }
 
+/* Bandwidth limits. Large transfers draw from a global token bucket
+   and from one bucket per client address. The buckets start full, so
+   that a transfer starts without delay, and they hold a fraction of a
+   second of data, to avoid bursts after an idle period. */
+class TokenBucket {
+public:
+    void refill(int64_t rate, std::chrono::steady_clock::time_point now) {
+        double burst = std::max(static_cast<double>(rate) / 4, 16384.0);
+        if (last == std::chrono::steady_clock::time_point()) {
+            tokens = burst;
+        } else {
+            std::chrono::duration<double> elapsed = now - last;
+            tokens = std::min(burst, tokens + elapsed.count() * static_cast<double>(rate));
+        }
+        last = now;
+    }
+    double tokens{0};
+    std::chrono::steady_clock::time_point last;
+};
+
+static int64_t rateLimitGlobal;
+static int64_t rateLimitClient;
+static TokenBucket rateGlobalBucket;
+/* Indexed by the client address bytes */
+static std::unordered_map<std::string, TokenBucket> rateClientBuckets;
+static std::mutex rateLimitMutex;
+
+void web_server_set_rate_limits(int64_t global_rate, int64_t client_rate)
+{
+    std::scoped_lock lck(rateLimitMutex);
+    rateLimitGlobal = global_rate;
+    rateLimitClient = client_rate;
+    rateGlobalBucket = TokenBucket();
+    rateClientBuckets.clear();
+}
+
+/* Decide if a transfer of the given size (-1 if unknown) should be
+   rate limited. Small ones are exempt so that description documents
+   and the like are not stuck behind streams. */
+static bool rateLimitApplies(int64_t size)
+{
+    std::scoped_lock lck(rateLimitMutex);
+    if (rateLimitGlobal <= 0 && rateLimitClient <= 0) {
+        return false;
+    }
+    return size < 0 || size >= WEB_SERVER_RATE_LIMIT_MIN_SIZE;
+}
+
+static std::string rateLimitClientKey(const struct sockaddr_storage& addr)
+{
+    if (addr.ss_family == AF_INET6) {
+        auto a6 = reinterpret_cast<const struct sockaddr_in6*>(&addr);
+        return std::string(reinterpret_cast<const char*>(&a6->sin6_addr), sizeof(a6->sin6_addr));
+    }
+    auto a4 = reinterpret_cast<const struct sockaddr_in*>(&addr);
+    return std::string(reinterpret_cast<const char*>(&a4->sin_addr), sizeof(a4->sin_addr));
+}
+
+/* Get permission to send up to want bytes. Returns the allowed count,
+   or 0, in which case delay is set to the time to wait before trying
+   again. */
+static size_t rateLimitTake(const std::string& client, size_t want,
+                            std::chrono::milliseconds& delay)
+{
+    if (want == 0) {
+        delay = std::chrono::milliseconds(1);
+        return 0;
+    }
+    std::scoped_lock lck(rateLimitMutex);
+    auto now = std::chrono::steady_clock::now();
+    // Don't dribble tiny chunks: wait until we can send a reasonable amount
+    auto minchunk = static_cast<double>(std::min(want, static_cast<size_t>(4096)));
+    double avail = static_cast<double>(want);
+    double waitsecs{0};
+    TokenBucket *cbucket{nullptr};
+    if (rateLimitGlobal > 0) {
+        rateGlobalBucket.refill(rateLimitGlobal, now);
+        avail = std::min(avail, rateGlobalBucket.tokens);
+        waitsecs = std::max(waitsecs, (minchunk - rateGlobalBucket.tokens) / rateLimitGlobal);
+    }
+    if (rateLimitClient > 0) {
+        if (rateClientBuckets.size() > 256) {
+            // Forget about clients which have been idle long enough for their bucket to be full.
+            for (auto it = rateClientBuckets.begin(); it != rateClientBuckets.end();) {
+                if (now - it->second.last > std::chrono::seconds(10)) {
+                    it = rateClientBuckets.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        cbucket = &rateClientBuckets[client];
+        cbucket->refill(rateLimitClient, now);
+        avail = std::min(avail, cbucket->tokens);
+        waitsecs = std::max(waitsecs, (minchunk - cbucket->tokens) / rateLimitClient);
+    }
+    if (avail < minchunk) {
+        delay = std::chrono::milliseconds(std::max(1, static_cast<int>(waitsecs * 1000 + 1)));
+        return 0;
+    }
+    auto grant = static_cast<size_t>(avail);
+    if (rateLimitGlobal > 0) {
+        rateGlobalBucket.tokens -= static_cast<double>(grant);
+    }
+    if (cbucket) {
+        cbucket->tokens -= static_cast<double>(grant);
+    }
+    return grant;
+}
+
+/* Return the part of a grant which was not actually sent (short or
+   would-block read) */
+static void rateLimitGiveBack(const std::string& client, size_t unused)
+{
+    if (unused == 0) {
+        return;
+    }
+    std::scoped_lock lck(rateLimitMutex);
+    if (rateLimitGlobal > 0) {
+        rateGlobalBucket.tokens += static_cast<double>(unused);
+    }
+    if (rateLimitClient > 0) {
+        auto it = rateClientBuckets.find(client);
+        if (it != rateClientBuckets.end()) {
+            it->second.tokens += static_cast<double>(unused);
+        }
+    }
+}
+
 class VFileReaderCtxt {
 public:
     UpnpWebFileHandle fp{nullptr};
     const void *cookie;
     const void *request_cookie;
+    /* Rate-limited document root file: we read it ourselves */
+    int fd{-1};
+    int64_t fdoffset{0};
+    /* Rate limiting: client key for the token bucket */
+    bool ratelimited{false};
+    std::string client;
+    /* Async reads state, protected by asyncReadsMutex */
+    MHD_Connection *conn{nullptr};
+    UpnpWebReadToken token{0};
+    bool suspended{false};
+    bool ready{false};
 };
 
+/* Transfers using the async read callback, indexed by token. Entries
+   are removed by the free callback, so that a late readiness signal
+   from the application can't reach a deleted context. */
+static std::unordered_map<UpnpWebReadToken, VFileReaderCtxt*> asyncReads;
+static UpnpWebReadToken asyncReadsNextToken{1};
+static bool asyncReadsAborted{false};
+static std::mutex asyncReadsMutex;
+static std::condition_variable asyncReadsCV;
+
+int web_server_read_ready(uint64_t token)
+{
+    std::scoped_lock lck(asyncReadsMutex);
+    auto it = asyncReads.find(token);
+    if (it == asyncReads.end()) {
+        return UPNP_E_INVALID_PARAM;
+    }
+    auto ctx = it->second;
+    if (ctx->suspended) {
+        // The connection can't go away while suspended, and we resume it
+        // under the lock, so there is no race with the reader callback
+        ctx->suspended = false;
+        MHD_resume_connection(ctx->conn);
+    } else {
+        // Either the reader has not suspended the connection yet, or we
+        // are running thread-per-connection and it is waiting for us.
+        ctx->ready = true;
+        asyncReadsCV.notify_all();
+    }
+    return UPNP_E_SUCCESS;
+}
+
+void web_server_abort_async_reads()
+{
+    std::scoped_lock lck(asyncReadsMutex);
+    asyncReadsAborted = true;
+    for (auto& [token, ctx] : asyncReads) {
+        if (ctx->suspended) {
+            ctx->suspended = false;
+            MHD_resume_connection(ctx->conn);
+        }
+    }
+    asyncReadsCV.notify_all();
+}
+
+/* Handle an UPNP_E_WOULD_BLOCK return from the async read
+   callback. Returns 0 (MHD will call the reader again), or an error. */
+static ssize_t vFileReaderWait(VFileReaderCtxt *ctx)
+{
+    std::unique_lock lck(asyncReadsMutex);
+    if (asyncReadsAborted) {
+        return MHD_CONTENT_READER_END_WITH_ERROR;
+    }
+    if (ctx->ready) {
+        // Signalled between the read call and now: try again.
+        ctx->ready = false;
+        return 0;
+    }
+    if (g_webServerThreads > 0) {
+        // Release the thread until the application calls UpnpVirtualDirReadReady()
+        ctx->suspended = true;
+        MHD_suspend_connection(ctx->conn);
+        return 0;
+    }
+    // Thread per connection: no suspend/resume, just wait.
+    if (!asyncReadsCV.wait_for(lck, std::chrono::seconds(HTTP_DEFAULT_TIMEOUT),
+                               [ctx]{return ctx->ready || asyncReadsAborted;})) {
+        UpnpPrintf(UPNP_ERROR, HTTP, __FILE__, __LINE__, "vFileReaderWait: timed out\n");
+        return MHD_CONTENT_READER_END_WITH_ERROR;
+    }
+    if (asyncReadsAborted) {
+        return MHD_CONTENT_READER_END_WITH_ERROR;
+    }
+    ctx->ready = false;
+    return 0;
+}
+
+/* Resumes a connection suspended for rate limiting */
+class RateLimitJobWorker : public JobWorker {
+public:
+    explicit RateLimitJobWorker(UpnpWebReadToken token)
+        : m_token(token) {}
+    void work() override {
+        web_server_read_ready(m_token);
+    }
+private:
+    UpnpWebReadToken m_token;
+};
+
+/* Wait until the rate limits let us send some more data. Returns 0
+   (MHD will call the reader again), or an error. */
+static ssize_t vFileReaderDelay(VFileReaderCtxt *ctx, std::chrono::milliseconds delay)
+{
+    if (g_webServerThreads > 0 && ctx->token) {
+        // The timer is set under the lock: once the reads are aborted,
+        // UpnpFinish() may delete the timer thread.
+        std::scoped_lock lck(asyncReadsMutex);
+        if (asyncReadsAborted) {
+            return MHD_CONTENT_READER_END_WITH_ERROR;
+        }
+        auto worker = std::make_unique<RateLimitJobWorker>(ctx->token);
+        if (gTimerThread->schedule(TimerThread::SHORT_TERM, delay, nullptr, std::move(worker)) !=
+            UPNP_E_SUCCESS) {
+            // Just try again
+            return 0;
+        }
+        ctx->suspended = true;
+        MHD_suspend_connection(ctx->conn);
+        return 0;
+    }
+    // Thread per connection: we can just sleep
+    std::this_thread::sleep_for(delay);
+    return 0;
+}
+
 static ssize_t vFileReaderCallback(void *cls, uint64_t pos, char *buf, size_t max)
 {
-    (void)pos;
     auto ctx = static_cast<VFileReaderCtxt*>(cls);
-    if (nullptr == ctx->fp) {
+    if (nullptr == ctx->fp && ctx->fd < 0) {
         UpnpPrintf(UPNP_ERROR, MSERV, __FILE__, __LINE__, "vFileReaderCallback: fp is null !\n");
         return MHD_CONTENT_READER_END_WITH_ERROR;
     }
 
-    int ret = virtualDirCallback.read(ctx->fp, buf, max, ctx->cookie, ctx->request_cookie);
+    if (ctx->ratelimited) {
+        std::chrono::milliseconds delay{1};
+        max = rateLimitTake(ctx->client, max, delay);
+        if (max == 0) {
+            return vFileReaderDelay(ctx, delay);
+        }
+    }
+
+    int ret;
+    bool wouldblock{false};
+    if (ctx->fd >= 0) {
+        ret = static_cast<int>(PREAD(ctx->fd, buf, max, static_cast<int64_t>(ctx->fdoffset + pos)));
+    } else if (ctx->token && virtualDirCallback.read_async) {
+        ret = virtualDirCallback.read_async(
+            ctx->fp, buf, max, ctx->cookie, ctx->request_cookie, ctx->token);
+        wouldblock = ret == UPNP_E_WOULD_BLOCK;
+    } else {
+        ret = virtualDirCallback.read(ctx->fp, buf, max, ctx->cookie, ctx->request_cookie);
+    }
+
+    if (ctx->ratelimited) {
+        // Only pay for the bytes we actually return
+        rateLimitGiveBack(ctx->client, ret > 0 ? max - static_cast<size_t>(ret) : max);
+    }
+    if (wouldblock) {
+        return vFileReaderWait(ctx);
+    }
 
     /* From the microhttpd manual: Note that returning zero will cause
        MHD to try again. Thus, returning zero should only be used in
@@ -648,11 +1177,43 @@ static void vFileFreeCallback (void *cls)
 {
     if (cls) {
         auto ctx = static_cast<VFileReaderCtxt*>(cls);
-        virtualDirCallback.close(ctx->fp, ctx->cookie, ctx->request_cookie);
+        if (ctx->token) {
+            std::scoped_lock lck(asyncReadsMutex);
+            asyncReads.erase(ctx->token);
+        }
+        if (ctx->fd >= 0) {
+            CLOSE(ctx->fd);
+        } else {
+            virtualDirCallback.close(ctx->fp, ctx->cookie, ctx->request_cookie);
+        }
         delete ctx;
     }
 }
 
+/* Register a reader context for suspend/resume, if it uses the async
+   read callback or may have to wait for the rate limits */
+static void vFileReaderRegister(VFileReaderCtxt *ctx, MHD_Connection *conn)
+{
+    if (virtualDirCallback.read_async || ctx->ratelimited) {
+        ctx->conn = conn;
+        std::scoped_lock lck(asyncReadsMutex);
+        ctx->token = asyncReadsNextToken++;
+        asyncReads[ctx->token] = ctx;
+    }
+}
+
+#if MHD_VERSION >= 0x00097302
+static void localDocFreeCallback(void *cls)
+{
+    delete static_cast<std::shared_ptr<const LocalDoc>*>(cls);
+}
+
+static void fileDataFreeCallback(void *cls)
+{
+    delete static_cast<std::shared_ptr<const std::string>*>(cls);
+}
+#endif
+
 static void web_server_callback(MHDTransaction *mhdt)
 {
     int ret;
@@ -675,9 +1236,44 @@ static void web_server_callback(MHDTransaction *mhdt)
         switch (rtype) {
         case RESP_FILEDOC:
         {
-            int fd = OPEN(filename.c_str(), 0);
+            if (RespInstr.filedata) {
+                // Small file from the cache
+                const auto& data = *RespInstr.filedata;
+                auto offset = std::min(static_cast<size_t>(RespInstr.offset), data.size());
+                auto size = std::min(static_cast<size_t>(RespInstr.ReadSendSize),
+                                     data.size() - offset);
+#if MHD_VERSION >= 0x00097302
+                auto datap = new std::shared_ptr<const std::string>(std::move(RespInstr.filedata));
+                mhdt->response = MHD_create_response_from_buffer_with_free_callback_cls(
+                    size, (*datap)->data() + offset, fileDataFreeCallback, datap);
+#else
+                mhdt->response = MHD_create_response_from_buffer(
+                    size, const_cast<char*>(data.data()) + offset, MHD_RESPMEM_MUST_COPY);
+#endif
+                mhdt->httpstatus = 200;
+                mhdt->respsize = static_cast<int64_t>(size);
+                break;
+            }
+            int fd = RespInstr.fd;
+            RespInstr.fd = -1;
+            if (fd < 0) {
+                fd = OPEN(filename.c_str(), 0);
+            }
             if (fd < 0) {
                 http_SendStatusResponse(mhdt, HTTP_FORBIDDEN);
+            } else if (rateLimitApplies(RespInstr.ReadSendSize)) {
+                // Read through a callback, so that we can pace the
+                // transfer. This loses the sendfile() optimisation.
+                auto ctx = new VFileReaderCtxt;
+                ctx->fd = fd;
+                ctx->fdoffset = RespInstr.offset;
+                ctx->ratelimited = true;
+                ctx->client = rateLimitClientKey(mhdt->client_address);
+                vFileReaderRegister(ctx, mhdt->conn);
+                mhdt->response = MHD_create_response_from_callback(
+                    RespInstr.ReadSendSize, 32 * 1024, vFileReaderCallback, ctx, vFileFreeCallback);
+                mhdt->httpstatus = 200;
+                mhdt->respsize = RespInstr.ReadSendSize;
             } else {
 #if MHD_VERSION <= 0x00093700
                 // Not sure exactly at_offset64 appeared, but 0.9.37
@@ -689,6 +1285,7 @@ static void web_server_callback(MHDTransaction *mhdt)
                     RespInstr.ReadSendSize, fd, RespInstr.offset);
 #endif
                 mhdt->httpstatus = 200;
+                mhdt->respsize = RespInstr.ReadSendSize;
             }
         }
         break;
@@ -703,6 +1300,11 @@ static void web_server_callback(MHDTransaction *mhdt)
             }
             ctx->cookie = RespInstr.cookie;
             ctx->request_cookie = RespInstr.request_cookie;
+            if (rateLimitApplies(RespInstr.ReadSendSize)) {
+                ctx->ratelimited = true;
+                ctx->client = rateLimitClientKey(mhdt->client_address);
+            }
+            vFileReaderRegister(ctx, mhdt->conn);
             if (RespInstr.offset) {
                 auto r = virtualDirCallback.seek(
                     ctx->fp, RespInstr.offset, SEEK_SET, ctx->cookie, ctx->request_cookie);
@@ -712,6 +1314,7 @@ static void web_server_callback(MHDTransaction *mhdt)
             }
             mhdt->response = MHD_create_response_from_callback(
                 RespInstr.ReadSendSize, 4096, vFileReaderCallback, ctx, vFileFreeCallback);
+            mhdt->respsize = RespInstr.ReadSendSize;
             if (RespInstr.IsPartial) {
                 std::string bytesrange = std::string("bytes ") + lltodecstr(RespInstr.offset) + "-" +
                     lltodecstr(RespInstr.offset + RespInstr.ReadSendSize -1) + "/" +
@@ -725,10 +1328,22 @@ static void web_server_callback(MHDTransaction *mhdt)
         break;
 
         case RESP_XMLDOC:
+        {
+            mhdt->respsize = static_cast<int64_t>(RespInstr.localdoc->data.size());
+#if MHD_VERSION >= 0x00097302
+            // Send directly from the shared document data. The reference
+            // keeps it alive until the response is destroyed.
+            auto docp = new std::shared_ptr<const LocalDoc>(std::move(RespInstr.localdoc));
+            mhdt->response = MHD_create_response_from_buffer_with_free_callback_cls(
+                (*docp)->data.size(), (*docp)->data.data(), localDocFreeCallback, docp);
+#else
+            const std::string& data = RespInstr.localdoc->data;
             mhdt->response = MHD_create_response_from_buffer(
-                RespInstr.data.size(), strdup(RespInstr.data.c_str()), MHD_RESPMEM_MUST_FREE);
+                data.size(), strdup(data.c_str()), MHD_RESPMEM_MUST_FREE);
+#endif
             mhdt->httpstatus = 200;
-            break;
+        }
+        break;
 
         default:
             UpnpPrintf(UPNP_INFO, HTTP, __FILE__, __LINE__,
@@ -757,6 +1372,10 @@ static void web_server_callback(MHDTransaction *mhdt)
 int web_server_init()
 {
     bWebServerState = WEB_SERVER_ENABLED;
+    {
+        std::scoped_lock lck(asyncReadsMutex);
+        asyncReadsAborted = false;
+    }
     SetHTTPGetCallback(web_server_callback);
     return 0;
 }
@@ -770,8 +1389,12 @@ void web_server_destroy()
 {
     if (bWebServerState == WEB_SERVER_ENABLED) {
         SetHTTPGetCallback(nullptr);
-        gDocumentRootDir.clear();
-        localDocs.clear();
+        updateWebConfig([](WebServerConfig& cfg) {
+            cfg.documentRootDir.clear();
+            cfg.localDocs.clear();
+        });
+        fileCacheClear();
+        web_server_clear_info_cache(nullptr);
         bWebServerState = WEB_SERVER_DISABLED;
     }
 }
@@ -0,0 +1,103 @@
+/* Copyright (C) 2026 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Check the compile-time MIME table used by the web server, and compare its
+// lookup speed with the previous unordered_map version.
+
+#include "src/inc/mimetypes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static std::unordered_map<std::string_view, std::string_view> mapTypes;
+
+// The previous method: lowercase copy and hash map lookup
+static std::string_view maplookup(const char *e)
+{
+    std::string le(e);
+    std::transform(le.begin(), le.end(), le.begin(), ::tolower);
+    auto it = mapTypes.find(le);
+    return it == mapTypes.end() ? std::string_view() : it->second;
+}
+
+static std::string_view hashlookup(const char *e)
+{
+    return mimetypes::mimetype_for_ext(e);
+}
+
+template <class F> static long long bench(const std::vector<std::string>& exts, int loops, F func)
+{
+    size_t found{0};
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++) {
+        for (const auto& ext : exts) {
+            found += func(ext.c_str()).size();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    // Use the result so that the loop is not optimized away
+    if (found == 0)
+        printf("Nothing found ??\n");
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    int loops = argc > 1 ? atoi(argv[1]) : 100000;
+    int errors = 0;
+
+    std::vector<std::string> exts;
+    for (const auto& entry : mimetypes::gMimeEntries) {
+        mapTypes[entry.ext] = entry.type;
+        std::string ext(entry.ext);
+        exts.push_back(ext);
+        std::string uext(ext);
+        std::transform(uext.begin(), uext.end(), uext.begin(), ::toupper);
+        exts.push_back(uext);
+    }
+    // A few misses
+    exts.push_back("flac");
+    exts.push_back("jpgx");
+    exts.push_back("");
+    exts.push_back("verylongextension");
+
+    for (const auto& ext : exts) {
+        if (maplookup(ext.c_str()) != hashlookup(ext.c_str())) {
+            printf("Mismatch for [%s]\n", ext.c_str());
+            errors++;
+        }
+    }
+    if (errors) {
+        return 1;
+    }
+
+    auto lookups = static_cast<double>(exts.size()) * loops;
+    auto tmap = bench(exts, loops, maplookup);
+    auto thash = bench(exts, loops, hashlookup);
+    printf("%zu entries, perfect hash seed %u, %d loops\n",
+           mimetypes::gMimeEntriesCount, mimetypes::gMimeSeed, loops);
+    printf("unordered_map: %.2f ns/lookup\n", tmap / lookups);
+    printf("perfect hash:  %.2f ns/lookup\n", thash / lookups);
+    return 0;
+}
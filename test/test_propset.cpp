@@ -0,0 +1,130 @@
+/* Copyright (C) 2026 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Check the in-place GENA property set parser: decoded values for the
+// accepted documents, and refusal (the caller then uses the XML parser)
+// for the ones it can't handle like the XML parser would.
+
+#include "src/inc/propsetparse.h"
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+static const std::string head{
+    "<?xml version=\"1.0\"?>\n"
+    "<e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\"><e:property><Var>"};
+static const std::string tail{"</Var></e:property></e:propertyset>"};
+
+struct Accepted {
+    const char *raw;
+    const char *value;
+};
+
+static const std::vector<Accepted> accepted{
+    {"plain", "plain"},
+    {"  trimmed\t\n", "trimmed"},
+    {"a &lt;b&gt; &amp; &quot;c&quot; &apos;d&apos;", "a <b> & \"c\" 'd'"},
+    {"&#65;&#x42;&#x0043;&#0068;", "ABCD"},
+    {"&#xe9;&#x20AC;&#x1F600;", "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"},
+    // Line ends are normalized, but not a CR coming from a reference
+    {"a\r\nb\rc\n\rd", "a\nb\nc\n\nd"},
+    {"a&#13;\nb&#xD;", "a\r\nb"},
+    {"x\r\n\r\n", "x"},
+};
+
+static const std::vector<const char *> refused{
+    "&#;", "&#x;", "&# 65;", "&#+65;", "&#-65;", "&#0x41;", "&#x 41;", "&#65 ;",
+    "&#X41;", "&#6a;", "&#xG1;",
+    // Not XML Chars
+    "&#0;", "&#x1;", "&#8;", "&#xB;", "&#x1F;", "&#xD800;", "&#xDFFF;", "&#xFFFE;",
+    "&#xFFFF;", "&#x110000;", "&#99999999999999999999;",
+    "&unknown;", "&amp", "<![CDATA[x]]>", "<!-- c -->x", "<b>x</b>",
+};
+
+static const std::string top{"<e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\">"};
+
+// Malformed documents, which the XML parser rejects
+static const std::vector<std::string> refusedDocs{
+    head + "x" + tail + "junk",
+    head + "x" + tail + "<e:propertyset/>",
+    top + "<e:property><Var>x</Var></f:property></e:propertyset>",
+    top + "<e:property><Var>x</Var></e:property></f:propertyset>",
+    top + "<e:property><Var a=\"x>y</Var></e:property></e:propertyset>",
+    top + "<e:property><Var a='x>y</Var></e:property></e:propertyset>",
+    top + "<e:property><Var a=\"<\">y</Var></e:property></e:propertyset>",
+    "<e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0><e:property><Var>x</Var>"
+    "</e:property></e:propertyset>",
+};
+
+int main()
+{
+    int errors = 0;
+    for (const auto& test : accepted) {
+        std::string doc = head + test.raw + tail;
+        propsetparse::PropertyViews vars;
+        if (!propsetparse::parseInPlace(doc, vars) || vars.size() != 1 ||
+            vars[0].first != "Var" || vars[0].second != test.value) {
+            printf("Bad result for [%s]\n", test.raw);
+            errors++;
+        }
+    }
+    for (const auto raw : refused) {
+        std::string doc = head + raw + tail;
+        std::string orig = doc;
+        propsetparse::PropertyViews vars;
+        if (propsetparse::parseInPlace(doc, vars) || doc != orig) {
+            printf("Not refused: [%s]\n", raw);
+            errors++;
+        }
+    }
+
+    for (const auto& raw : refusedDocs) {
+        std::string doc = raw;
+        propsetparse::PropertyViews vars;
+        if (propsetparse::parseInPlace(doc, vars) || doc != raw) {
+            printf("Not refused: [%s]\n", raw.c_str());
+            errors++;
+        }
+    }
+
+    // A '>' in an attribute value does not end the tag, and white space or
+    // processing instructions may follow the document
+    std::string doc{"<e:propertyset xmlns:e='urn:schemas-upnp-org:event-1-0' a=\"b>c\">"
+                    "<e:property><Var a='>'>value</Var></e:property></e:propertyset>"
+                    "\n<?pi x?>\n"};
+    propsetparse::PropertyViews vars;
+    if (!propsetparse::parseInPlace(doc, vars) || vars.size() != 1 || vars[0].second != "value") {
+        printf("Bad result for the attributes document\n");
+        errors++;
+    }
+
+    doc = std::string{"<e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\">\r\n"
+                    "<e:property><A>1</A></e:property>\r\n"
+                    "<e:property><B/><C>x &amp; y</C></e:property>\r\n"
+                    "</e:propertyset>\r\n"};
+    vars.clear();
+    if (!propsetparse::parseInPlace(doc, vars) || vars.size() != 3 ||
+        vars[0] != std::make_pair(std::string_view("A"), std::string_view("1")) ||
+        vars[1] != std::make_pair(std::string_view("B"), std::string_view()) ||
+        vars[2] != std::make_pair(std::string_view("C"), std::string_view("x & y"))) {
+        printf("Bad result for the multiple variables document\n");
+        errors++;
+    }
+    return errors ? 1 : 0;
+}
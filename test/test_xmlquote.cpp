@@ -0,0 +1,133 @@
+/* Copyright (C) 2026 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published by
+ *   the Free Software Foundation; either version 2.1 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// Check the XML escaping used for the SOAP and GENA messages against the
+// previous character by character version. With -b, also compare their
+// speed on a DIDL-Lite document like the ones returned by a media
+// server Browse:  test_xmlquote -b [loops]
+
+#include "src/inc/xmlbuild.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// The previous method
+static std::string oldQuote(const std::string& in)
+{
+    std::string out;
+    out.reserve(in.size());
+    for (char i : in) {
+        switch (i) {
+        case '"': out += "&quot;"; break;
+        case '&': out += "&amp;"; break;
+        case '<': out += "&lt;"; break;
+        case '>': out += "&gt;"; break;
+        case '\'': out += "&apos;"; break;
+        default: out += i;
+        }
+    }
+    return out;
+}
+
+static std::string newQuote(const std::string& in)
+{
+    std::string out;
+    out.reserve(in.size() + in.size() / 8);
+    xmlbuild::appendQuoted(out, in);
+    return out;
+}
+
+static std::string didl(int count)
+{
+    std::string out{R"(<DIDL-Lite xmlns="urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/" )"
+                    R"(xmlns:dc="http://purl.org/dc/elements/1.1/" )"
+                    R"(xmlns:upnp="urn:schemas-upnp-org:metadata-1-0/upnp/">)"};
+    for (int i = 0; i < count; i++) {
+        auto n = std::to_string(i);
+        out += R"(<item id="0$=$)" + n + R"(" parentID="0$=" restricted="1">)"
+            "<dc:title>Track " + n + " - Rock &amp; Roll (Live at the Hall)</dc:title>"
+            "<upnp:artist>The Somebody's Band</upnp:artist>"
+            "<upnp:album>Greatest Hits Volume " + n + "</upnp:album>"
+            "<upnp:class>object.item.audioItem.musicTrack</upnp:class>"
+            R"(<res duration="0:03:41.000" size="8845321" )"
+            R"(protocolInfo="http-get:*:audio/flac:*">http://192.168.1.10:9790/minimserver/)"
+            "*/music/Some*20Artist/Greatest*20Hits/" + n + ".flac?a=1&amp;b=2</res>"
+            "</item>";
+    }
+    out += "</DIDL-Lite>";
+    return out;
+}
+
+template <class F> static long long bench(const std::vector<std::string>& inputs, int loops, F func)
+{
+    size_t total{0};
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++) {
+        for (const auto& input : inputs) {
+            total += func(input).size();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    // Use the result so that the loop is not optimized away
+    if (total == 0)
+        printf("Empty output ??\n");
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    bool dobench = argc > 1 && std::string(argv[1]) == "-b";
+    int loops = dobench && argc > 2 ? atoi(argv[2]) : 200;
+
+    std::vector<std::string> inputs{
+        "", "a", "&", "<<>>", "plain text with no special characters at all",
+        "'quoted' \"double\" & <tag>", std::string(100, '&'), std::string(37, 'x') + "<",
+        didl(1), didl(10), didl(500)};
+
+    int errors = 0;
+    for (const auto& input : inputs) {
+        if (oldQuote(input) != newQuote(input)) {
+            printf("Mismatch for [%.60s]\n", input.c_str());
+            errors++;
+        }
+    }
+    xmlbuild::XMLBuilder builder(100);
+    builder.append("<a>").element("b", "x<y").element("c", "&amp;", false).append("</a>");
+    if (builder.take() != "<a><b>x&lt;y</b><c>&amp;</c></a>") {
+        printf("Builder output mismatch\n");
+        errors++;
+    }
+    if (errors) {
+        return 1;
+    }
+    if (!dobench) {
+        return 0;
+    }
+
+    std::vector<std::string> big{didl(500)};
+    auto bytes = static_cast<double>(big[0].size()) * loops;
+    auto told = bench(big, loops, oldQuote);
+    auto tnew = bench(big, loops, newQuote);
+    printf("DIDL-Lite document: %zu bytes, %d loops\n", big[0].size(), loops);
+    printf("previous: %.3f ns/byte\n", told / bytes);
+    printf("scan:     %.3f ns/byte\n", tnew / bytes);
+    return 0;
+}